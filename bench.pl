@@ -0,0 +1,189 @@
+:- consult(plasteroids).
+
+% Microbenchmarks for the maths kernels and the sdl.c term decoders.
+%
+% Each case reports calls per second. A run fails if a case falls below
+% bench_ratio/1 of its rate in bench_baseline.pl, or below its bench_target/2
+% where the target comes from a requirement. `make bench-baseline` records
+% the baseline on the machine it runs on; `make bench-micro` compares
+% against it.
+
+:- initialization(bench_micro, main).
+
+:- dynamic bench_baseline/2.
+:- multifile bench_baseline/2.
+
+:- if(exists_file('bench_baseline.pl')).
+:- consult(bench_baseline).
+:- endif.
+
+bench_iterations(20000).
+
+% No case runs much longer than this, however slow it is.
+bench_seconds(2).
+
+bench_ratio(0.8).
+
+% bench_case(Name, Setup, Goal): Setup runs once and binds variables shared
+% with Goal.
+bench_case(vec2_eval,
+    true,
+    vec2_eval(_, vec2(1.5, 2.5) + scale(3, unit_rad(0.5)) - vec2(6, 7))).
+
+bench_case(fastsin,
+    true,
+    fastsin(1.234, _)).
+
+bench_case(asteroid_polygon,
+    make_asteroid(30, 640, 480, Asteroid),
+    asteroid_polygon(Asteroid, _)).
+
+bench_case(polygon_bounds,
+    (make_asteroid(30, 640, 480, Asteroid), asteroid_polygon(Asteroid, Points)),
+    polygon_bounds(Points, _)).
+
+bench_case(in_polygon,
+    (make_asteroid(30, 320, 240, Asteroid), get_dict(pos, Asteroid, Pos), asteroid_polygon(Asteroid, Points)),
+    in_polygon(Pos, Points)).
+
+% One frame of asteroid simulation for 1,000 asteroids. At 60 FPS the
+% simulation alone fits about Rate * 1000 / 60 asteroids in a frame.
+bench_case(update_asteroids_1000,
+    (stress_state(1000, State), get_dict(asteroids, State, Asteroids)),
+    maplist(update_asteroid(State, 0.016), Asteroids, _)).
+
+% Drawing the 20k stress field, mostly as points and quads, on a renderer
+% the size of the game's screen so that they are all rasterized.
+bench_case(draw_asteroids_20k,
+    (stress_state(20000, State),
+     get_dict(dim, State, vec2(Width, Height)),
+     sdl_create_renderer(offscreen(Width, Height), [], Renderer),
+     get_dict(asteroids, State, Asteroids),
+     get_dict(bounds, State, Bounds)),
+    draw_asteroids(Renderer, Bounds, Asteroids)).
+
+% Two ticks of rewind recording with 1,000 asteroids, each pushed against the
+% other so every delta is a real one.
+bench_case(record_snapshot_1000,
+    (initial_state(1000, 30, State0),
+     RewindBytes is 64 * 1024 * 1024,
+     sdl_create_rewind(600, RewindBytes, Rewind),
+     put_dict(rewind, State0, Rewind, State1),
+     get_time(Now),
+     simulate_state(Now, 0.016, State1, State2)),
+    (record_snapshot(State1), record_snapshot(State2))).
+
+% The shapes below are off screen, so culling skips the rasterizer and only
+% the decoders in sdl.c are measured.
+bench_case(sdl_draw_point,
+    bench_renderer(Renderer),
+    sdl_draw(Renderer, vec2(-10, -10))).
+
+bench_case(sdl_draw_line,
+    bench_renderer(Renderer),
+    sdl_draw(Renderer, line(vec2(-10, -10), vec2(-20.5, -30.5)))).
+
+bench_case(sdl_draw_many_100,
+    (bench_renderer(Renderer),
+     findall(line(vec2(-1, N), vec2(-2, N)), between(1, 100, N), Lines)),
+    sdl_draw_many(Renderer, [rgba(255, 255, 255, 255)|Lines])).
+
+bench_case(sdl_draw_many_rgba_100,
+    (bench_renderer(Renderer),
+     findall(rgba(N, 100, 50, 255), between(1, 100, N), Colors)),
+    sdl_draw_many(Renderer, Colors)).
+
+bench_case(sdl_draw_rect,
+    bench_renderer(Renderer),
+    sdl_draw(Renderer, rect(vec2(-10, -20.5), vec2(-30, -5)))).
+
+bench_case(sdl_draw_fill,
+    bench_renderer(Renderer),
+    sdl_draw(Renderer, fill(rect(vec2(-10, -20.5), vec2(-30, -5))))).
+
+% One frame of a 50k particle pool. The particles are on screen, so this
+% includes rasterizing the points.
+bench_case(particles_50k,
+    (bench_renderer(Renderer),
+     sdl_create_particles(65536, rgba(200, 200, 200, 255), Particles),
+     sdl_particles_spawn(Particles, vec2(32, 32), vec2(0, 0), burst(50000, 20, 3600))),
+    (sdl_particles_update(Particles, 0.0001), sdl_draw_particles(Renderer, Particles))).
+
+% bench_target(Name, MinCallsPerSecond)
+bench_target(record_snapshot_1000, 1000).   % 0.5 ms per tick
+bench_target(particles_50k, 1000).          % 1 ms per frame
+
+bench_renderer(Renderer) :-
+    (nb_current(bench_renderer, Renderer)
+        -> true
+        ;  sdl_init([video]),
+           sdl_create_window("bench", 64, 64, [hidden], Window),
+           sdl_create_renderer(Window, [software], Renderer),
+           nb_setval(bench_window, Window),
+           nb_setval(bench_renderer, Renderer)).
+
+bench_rate(Goal, Rate) :-
+    get_time(Start),
+    bench_loop(Goal, Start, 0, Count, End),
+    Rate is Count / max(End - Start, 1.0e-9).
+
+% Runs Goal in batches of 100 until either the iteration count or the time
+% budget is used up.
+bench_loop(Goal, Start, Done, Count, End) :-
+    forall(between(1, 100, _), Goal),
+    Done1 is Done + 100,
+    get_time(Now),
+    bench_iterations(Iterations),
+    bench_seconds(Seconds),
+    ((Done1 >= Iterations ; Now - Start >= Seconds)
+        -> Count = Done1,
+           End = Now
+        ;  bench_loop(Goal, Start, Done1, Count, End)).
+
+bench_run(Name, Name-Rate, Passed) :-
+    bench_case(Name, Setup, Goal),
+    call(Setup),
+    bench_rate(Goal, Rate),
+    bench_verdict(Name, Rate, Status, Passed),
+    format("~w~t~24|~t~0f~12+ calls/s  ~w~n", [Name, Rate, Status]).
+
+bench_verdict(Name, Rate, Status, false) :-
+    bench_target(Name, Target),
+    Rate < Target,
+    !,
+    format(atom(Status), "BELOW TARGET (~d)", [Target]).
+
+bench_verdict(Name, Rate, Status, false) :-
+    bench_baseline(Name, Baseline),
+    bench_ratio(Ratio),
+    Rate < Baseline * Ratio,
+    !,
+    format(atom(Status), "REGRESSION (baseline ~d)", [Baseline]).
+
+bench_verdict(Name, _, Status, true) :-
+    bench_baseline(Name, Baseline),
+    !,
+    format(atom(Status), "ok (baseline ~d)", [Baseline]).
+
+bench_verdict(_, _, 'ok (no baseline)', true).
+
+bench_record(Results) :-
+    setup_call_cleanup(
+        open('bench_baseline.pl', write, Out),
+        (format(Out, "% Recorded by `make bench-baseline`.~n~n:- multifile bench_baseline/2.~n~n", []),
+         forall(member(Name-Rate, Results),
+                (Rounded is round(Rate),
+                 portray_clause(Out, bench_baseline(Name, Rounded))))),
+        close(Out)).
+
+bench_micro :-
+    current_prolog_flag(argv, Argv),
+    argv_options(Argv, _, Options),
+    findall(Name, bench_case(Name, _, _), Names),
+    maplist(bench_run, Names, Results, Passed),
+    (option(record(true), Options)
+        -> bench_record(Results),
+           format("Recorded bench_baseline.pl~n")
+    ; memberchk(false, Passed)
+        -> halt(1)
+    ;  true).
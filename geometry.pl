@@ -39,49 +39,34 @@ polygon_lines(A, [B,C|Rest], [line(B,C)|Lines]) :-
 
 line_eq(line(vec2(X1, Y1), vec2(X2, Y2)), Slope, YIntercept) :-
     % Y = Slope * X + YIntercept
-    % YIntercept = Slope * X - Y
-    % Slope * X2 - Y2 = Slope * X1 - Y1
-    % Slope * X2 - Slope * X1 = Y2 - Y1 
-    % Slope * (X2 - X1) = Y2 - Y1 
     % Slope = (Y2 - Y1) / (X2 - X1)
+    % YIntercept = Y1 - Slope * X1
+    % Fails for vertical lines
     DX is X2 - X1,
-    DX = 0 -> (
-        false
-    ) ; (
-        Slope is (Y2 - Y1) / (X2 - X1),
-        YIntercept = Slope * X1 - Y1
-    ).
+    DX =\= 0,
+    Slope is (Y2 - Y1) / DX,
+    YIntercept is Y1 - Slope * X1.
 
 line_cross(L1, L2, vec2(X, Y)) :-
     % Does not account for vertical lines
     line_eq(L1, A, C),
     line_eq(L2, B, D),
-    A = B -> (
-        false
-    ) ; (
-        X is (D - C) / (A - B),
-        Y is A * X + C
-    ).
+    A =\= B,
+    X is (D - C) / (A - B),
+    Y is A * X + C.
 
-ray_crossing(line(vec2(X1, Y1), vec2(X2, Y2)), vec2(X, Y), vec2(CrossX, CrossY)) :-
-    (Y1 < Y, Y =< Y2; Y2 < Y, Y =< Y1),
-    (X1 = X2) ->
-        CrossX = X1,
-        CrossY = Y
-    ;
-        Y1 = Y2 ->
-            CrossX is min(X1, X2),
-            CrossY = Y
-            ;
-            Slope is (Y2 - Y1) / (X2 - X1),
-            Offset is Y1 - (Slope * X1),
-            false. % need to figure out how to do this shit
+% Holds if a ray cast from Pt towards +X crosses the line. The half-open Y
+% range skips horizontal lines and counts a shared vertex only once.
+ray_crossing(line(vec2(X1, Y1), vec2(X2, Y2)), vec2(X, Y)) :-
+    (Y1 =< Y, Y < Y2 ; Y2 =< Y, Y < Y1),
+    !,
+    CrossX is X1 + (Y - Y1) * (X2 - X1) / (Y2 - Y1),
+    X < CrossX.
 
-in_polygon(Pt, Center, Points) :-
-    polygon_lines(Points, Lines),
-    findall(CrossPoint, (member(Line, Lines), ray_crossing(Line, Pt, CrossPoint)), CrossPoints).
-    select(crosses(Y), Lines, Crosses),
+% Even-odd rule, so concave polygons work too.
+in_polygon(Pt, Points) :-
     polygon_bounds(Points, Bounds),
     in_bounds(Bounds, Pt),
-    in_polygon_center(Pt, Center, Points).
-
+    polygon_lines(Points, Lines),
+    aggregate_all(count, (member(Line, Lines), ray_crossing(Line, Pt)), Crossings),
+    Crossings mod 2 =:= 1.
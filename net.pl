@@ -0,0 +1,535 @@
+:- use_module(library(socket)).
+:- use_module(library(assoc)).
+
+% Loopback two-player mode.
+%
+% The server runs the authoritative simulation, with its own player as
+% State.ship and the client's player as State.peer. Every tick it sends the
+% client a quantised snapshot encoded against the newest snapshot the client
+% has acknowledged: ships and bullets as a byte delta, asteroids as one record
+% per asteroid keyed by its id. The client sends back the controls it holds,
+% its shots and that acknowledgement, draws the other entities interpolated
+% between the last two snapshots and predicts its own ship from local input.
+
+net_tick_rate(60).
+
+net_max_packet(65507).
+
+% Oldest unacknowledged snapshot the server keeps as a delta base.
+net_history(120).
+
+% Asteroids the client hasn't seen yet are sent whole, at most this many per
+% snapshot, so first contact can't outgrow a datagram; the rest follow over
+% the next few ticks.
+net_new_asteroids(64).
+
+%% Transport
+
+net_open(Port, Socket, Queue) :-
+    udp_socket(Socket),
+    tcp_bind(Socket, Port),
+    message_queue_create(Queue),
+    thread_create(net_receiver(Socket, Queue), _, [detached(true)]).
+
+% Blocks on the socket in its own thread, so neither game loop has to.
+% Exits when the socket is closed.
+net_receiver(Socket, Queue) :-
+    catch(net_receive_loop(Socket, Queue), _, true).
+
+net_receive_loop(Socket, Queue) :-
+    net_max_packet(Max),
+    udp_receive(Socket, Packet, From, [as(string), encoding(octet), max_message_size(Max)]),
+    get_time(Received),
+    string_length(Packet, Size),
+    (catch(fast_term_serialized(Message, Packet), _, fail)
+        -> thread_send_message(Queue, packet(From, Received, Size, Message))
+        ;  true),
+    net_receive_loop(Socket, Queue).
+
+net_drain(Queue, [Packet|Packets]) :-
+    thread_get_message(Queue, Packet, [timeout(0)]),
+    !,
+    net_drain(Queue, Packets).
+
+net_drain(_, []).
+
+% Fails, rather than sending, on a message too large for one datagram.
+net_send(Socket, To, Message, Size) :-
+    fast_term_serialized(Message, Packet),
+    string_length(Packet, Size),
+    net_max_packet(Max),
+    Size =< Max,
+    udp_send(Socket, Packet, To, [encoding(octet)]).
+
+net_pace(Start) :-
+    net_tick_rate(Rate),
+    get_time(Now),
+    Remaining is 1 / Rate - (Now - Start),
+    (Remaining > 0 -> sleep(Remaining) ; true).
+
+net_done(quit, _) :- !.
+
+net_done(_, Net) :-
+    Net.limit > 0,
+    Net.ticks >= Net.limit.
+
+prune_history(Min, History, Pruned) :-
+    assoc_to_list(History, Pairs),
+    exclude(older_than(Min), Pairs, Kept),
+    list_to_assoc(Kept, Pruned).
+
+older_than(Min, Seq-_) :-
+    Seq < Min.
+
+%% Quantisation
+%
+% Positions and velocities are kept to 1/8 pixel and angles to 1/1024 of a
+% turn, so snapshots hold only small integers and unchanged fields serialise
+% to identical bytes.
+
+quantize(X, Q) :- Q is round(X * 8).
+
+dequantize(Q, X) :- X is Q / 8.
+
+quantize_vec2(vec2(X, Y), v(QX, QY)) :-
+    quantize(X, QX),
+    quantize(Y, QY).
+
+dequantize_vec2(v(QX, QY), vec2(X, Y)) :-
+    dequantize(QX, X),
+    dequantize(QY, Y).
+
+quantize_angle(A, Q) :- Q is round(A * 1024 / (2 * pi)) mod 1024.
+
+quantize_rate(A, Q) :- Q is round(A * 1024 / (2 * pi)).
+
+dequantize_angle(Q, A) :- A is Q * 2 * pi / 1024.
+
+quantize_ship(none, none) :- !.
+
+quantize_ship(Ship, ship(Pos, Vel, Dir, Accel)) :-
+    quantize_vec2(Ship.pos, Pos),
+    quantize_vec2(Ship.vel, Vel),
+    quantize_angle(Ship.dir, Dir),
+    Accel = Ship.accel.
+
+dequantize_ship(none, none) :- !.
+
+dequantize_ship(ship(QPos, QVel, QDir, Accel), Ship) :-
+    dequantize_vec2(QPos, Pos),
+    dequantize_vec2(QVel, Vel),
+    dequantize_angle(QDir, Dir),
+    Ship = ship{pos: Pos, vel: Vel, dir: Dir, turn: no, accel: Accel, size: 18}.
+
+quantize_bullet(Bullet, b(Pos, Vel)) :-
+    quantize_vec2(Bullet.pos, Pos),
+    quantize_vec2(Bullet.vel, Vel).
+
+dequantize_bullet(b(QPos, QVel), bullet{pos: Pos, vel: Vel, expiry: 0}) :-
+    dequantize_vec2(QPos, Pos),
+    dequantize_vec2(QVel, Vel).
+
+quantize_point(polar(D, R), p(QD, QR)) :-
+    QD is round(D * 64),
+    quantize_rate(R, QR).
+
+dequantize_point(p(QD, QR), polar(D, R)) :-
+    D is QD / 64,
+    dequantize_angle(QR, R).
+
+quantize_asteroid(Asteroid, Id-a(Pos, Speed, Heading, Rot, AngVel, Size, Points)) :-
+    Id = Asteroid.id,
+    quantize_vec2(Asteroid.pos, Pos),
+    polar(S, H) = Asteroid.vel,
+    quantize(S, Speed),
+    quantize_angle(H, Heading),
+    quantize_angle(Asteroid.rot, Rot),
+    quantize_rate(Asteroid.angvel, AngVel),
+    quantize(Asteroid.size, Size),
+    maplist(quantize_point, Asteroid.points, Points).
+
+dequantize_asteroid(Id-a(QPos, QSpeed, QHeading, QRot, QAngVel, QSize, QPoints), Asteroid) :-
+    dequantize_vec2(QPos, Pos),
+    dequantize(QSpeed, Speed),
+    dequantize_angle(QHeading, Heading),
+    dequantize_angle(QRot, Rot),
+    dequantize_angle(QAngVel, AngVel),
+    dequantize(QSize, Size),
+    maplist(dequantize_point, QPoints, Points),
+    Asteroid = asteroid{
+        id: Id,
+        size: Size,
+        pos: Pos,
+        points: Points,
+        vel: polar(Speed, Heading),
+        rot: Rot,
+        angvel: AngVel
+    }.
+
+% Snapshots are from the server's point of view: ship is the server's player.
+% Asteroids are Id-a(...) pairs.
+quantize_world(State, world(Ship, Peer, Bullets, Asteroids)) :-
+    quantize_ship(State.ship, Ship),
+    quantize_ship(State.peer, Peer),
+    maplist(quantize_bullet, State.bullets, Bullets),
+    maplist(quantize_asteroid, State.asteroids, Asteroids).
+
+%% Server
+
+net_serve(Port, Options, Renderer, State) :-
+    net_open(Port, Socket, Queue),
+    vec2(Width, Height) = State.dim,
+    initial_ship(Peer0, Width, Height),
+    PeerX is Width * 3 / 4,
+    PeerY is Height / 2,
+    Peer = Peer0.put(pos, vec2(PeerX, PeerY)),
+    option(ticks(Limit), Options, 0),
+    empty_assoc(History),
+    Net = net{
+        role: server,
+        socket: Socket,
+        queue: Queue,
+        client: none,
+        seq: 0,
+        acked: -1,
+        echo: 0,
+        history: History,
+        input_sent: 0,
+        ticks: 0,
+        bytes: 0,
+        dropped: 0,
+        limit: Limit
+    },
+    get_time(Now),
+    once(server_loop(Now, Renderer, State.put(peer, Peer), Net)),
+    tcp_close_socket(Socket).
+
+server_loop(Then, Renderer, State, Net) :-
+    (net_done(State, Net)
+        -> net_report(Net)
+        ;  draw_state(Renderer, State),
+           process_input(State, InputState),
+           net_drain(Net.queue, Packets),
+           foldl(server_receive, Packets, InputState-Net, PeerState-ReceivedNet),
+           get_time(Now),
+           Delta is Now - Then,
+           update_state(Now, Delta, PeerState, UpdatedState),
+           server_send(UpdatedState, ReceivedNet, SentNet),
+           net_pace(Now),
+           server_loop(Now, Renderer, UpdatedState, SentNet)).
+
+server_receive(_, quit-Net, quit-Net) :- !.
+
+% Every input packet carries the controls the client holds, so a lost packet
+% costs at most a tick of steering. Only the newest packet's controls are
+% applied; shots are edges and are taken from every packet.
+server_receive(packet(From, _, _, input(Ack, Sent, Controls, Events)), State-Net, NextState-NextNet) :-
+    !,
+    (Sent > Net.input_sent
+        -> peer_controls(Controls, State, ControlledState),
+           InputSent = Sent
+        ;  ControlledState = State,
+           InputSent = Net.input_sent),
+    include(fire_event, Events, FireEvents),
+    foldl(handle_peer_input, FireEvents, ControlledState, NextState),
+    Acked is max(Net.acked, Ack),
+    NextNet = Net.put(_{client: From, acked: Acked, echo: Sent, input_sent: InputSent}).
+
+server_receive(_, Acc, Acc).
+
+peer_controls(controls(Turn, Accel), State, NextState) :-
+    memberchk(Turn, [clockwise, counterclockwise, no]),
+    memberchk(Accel, [true, false]),
+    !,
+    (Accel == true, State.peer.accel == false
+        -> play_sound(State, thrust)
+        ;  true),
+    NextState = State.put(peer, State.peer.put(_{turn: Turn, accel: Accel})).
+
+peer_controls(_, State, State).
+
+% Only ship controls are taken from the client.
+peer_event(key(Key, _, _)) :-
+    memberchk(Key, ["Left", "Right", "Up", "Space"]).
+
+fire_event(key("Space", _, _)).
+
+handle_peer_input(Event, State, NextState) :-
+    handle_input(Event, State.put(ship, State.peer), Swapped),
+    NextState = Swapped.put(_{ship: State.ship, peer: Swapped.ship}).
+
+server_send(quit, Net, Net) :- !.
+
+server_send(_, Net, Net) :-
+    Net.client = none,
+    !.
+
+% History maps each sequence number to known(Head, Asteroids): the serialised
+% ships and bullets, and an assoc of the asteroids the client will have once
+% it gets that snapshot.
+server_send(State, Net, NextNet) :-
+    quantize_world(State, world(Ship, Peer, Bullets, Asteroids)),
+    fast_term_serialized(head(Ship, Peer, Bullets), Head),
+    Seq = Net.seq,
+    (get_assoc(Net.acked, Net.history, known(BaseHead, BaseAsteroids))
+        -> BaseSeq = Net.acked
+        ;  BaseSeq = -1,
+           BaseHead = "",
+           empty_assoc(BaseAsteroids)),
+    sdl_delta_encode(BaseHead, Head, HeadDelta),
+    net_new_asteroids(Budget),
+    asteroid_records(Asteroids, BaseAsteroids, Budget, Records, Known),
+    get_time(Sent),
+    (net_send(Net.socket, Net.client, snapshot(Seq, BaseSeq, Sent, Net.echo, HeadDelta, Records), Size)
+        -> list_to_assoc(Known, KnownAsteroids),
+           put_assoc(Seq, Net.history, known(Head, KnownAsteroids), History0),
+           Dropped = Net.dropped
+        ;  % Too big for a datagram; the next tick tries again from the same base.
+           Size = 0,
+           History0 = Net.history,
+           Dropped is Net.dropped + 1),
+    net_history(Keep),
+    Min is max(Net.acked, Seq - Keep),
+    prune_history(Min, History0, History),
+    NextSeq is Seq + 1,
+    Ticks is Net.ticks + 1,
+    Total is Net.bytes + Size,
+    NextNet = Net.put(_{seq: NextSeq, history: History, ticks: Ticks, bytes: Total, dropped: Dropped}).
+
+% asteroid_records(+Asteroids, +Base, +Budget, -Records, -Known)
+%
+% One record per asteroid: its bare id when the client already has it
+% unchanged, m(Id, Pos, Rot) when only its motion changed, or full(Id, A).
+% Known is the Id-A pairs the client will hold after applying Records.
+asteroid_records([], _, _, [], []).
+
+asteroid_records([Id-A|As], Base, Budget, Records, Known) :-
+    (get_assoc(Id, Base, BaseA)
+        -> asteroid_record(Id, BaseA, A, Record),
+           Records = [Record|Rs],
+           Known = [Id-A|Ks],
+           NextBudget = Budget
+    ; Budget > 0
+        -> Records = [full(Id, A)|Rs],
+           Known = [Id-A|Ks],
+           NextBudget is Budget - 1
+    ;  Records = Rs,
+       Known = Ks,
+       NextBudget = Budget),
+    asteroid_records(As, Base, NextBudget, Rs, Ks).
+
+asteroid_record(Id, A, A, Id) :- !.
+
+asteroid_record(Id, a(_, S, H, _, V, Z, P), a(Pos, S, H, Rot, V, Z, P), m(Id, Pos, Rot)) :- !.
+
+asteroid_record(Id, _, A, full(Id, A)).
+
+apply_record(Base, Id, Id-A) :-
+    integer(Id),
+    !,
+    get_assoc(Id, Base, A).
+
+apply_record(Base, m(Id, Pos, Rot), Id-a(Pos, S, H, Rot, V, Z, P)) :-
+    !,
+    get_assoc(Id, Base, a(_, S, H, _, V, Z, P)).
+
+apply_record(_, full(Id, A), Id-A).
+
+%% Client
+
+net_connect(Port, Options, Renderer, State) :-
+    net_open(_, Socket, Queue),
+    option(ticks(Limit), Options, 0),
+    option(autopilot(Autopilot), Options, false),
+    empty_assoc(Received),
+    Net = net{
+        role: client,
+        socket: Socket,
+        queue: Queue,
+        server: localhost:Port,
+        autopilot: Autopilot,
+        acked: -1,
+        received: Received,
+        prev: none,
+        latest: none,
+        ticks: 0,
+        bytes: 0,
+        limit: Limit,
+        snapshots: 0,
+        latency: 0,
+        rtt: 0,
+        rtt_samples: 0
+    },
+    get_time(Now),
+    once(client_loop(Now, Renderer, State.put(asteroids, []), Net)),
+    tcp_close_socket(Socket).
+
+client_loop(_, Renderer, State, Net) :-
+    (net_done(State, Net)
+        -> net_report(Net)
+        ;  sdl_poll_events(Events),
+           autopilot_events(Net, Autopilot),
+           append(Events, Autopilot, AllEvents),
+           include(peer_event, AllEvents, KeyEvents),
+           % Local controls drive prediction; the server decides everything else.
+           foldl(handle_input, KeyEvents, State, InputState),
+           client_controls(InputState, Controls),
+           include(fire_event, KeyEvents, FireEvents),
+           get_time(Now),
+           ignore(net_send(Net.socket, Net.server, input(Net.acked, Now, Controls, FireEvents), _)),
+           net_drain(Net.queue, Packets),
+           foldl(client_receive, Packets, Net, ReceivedNet),
+           client_view(Now, InputState, ReceivedNet, View),
+           draw_state(Renderer, View),
+           Ticks is ReceivedNet.ticks + 1,
+           NextNet = ReceivedNet.put(ticks, Ticks),
+           (memberchk(quit, Events)
+               -> NextState = quit
+               ;  NextState = InputState.put(_{bullets: [], time: Now})),
+           net_pace(Now),
+           client_loop(Now, Renderer, NextState, NextNet)).
+
+client_controls(quit, controls(no, false)) :- !.
+
+client_controls(State, controls(Turn, Accel)) :-
+    Turn = State.ship.turn,
+    Accel = State.ship.accel.
+
+client_receive(packet(_, Received, Size, snapshot(Seq, BaseSeq, Sent, Echo, HeadDelta, Records)), Net, NextNet) :-
+    Seq > Net.acked,
+    (BaseSeq =:= -1
+        -> BaseHead = "",
+           empty_assoc(BaseAsteroids)
+        ;  get_assoc(BaseSeq, Net.received, known(BaseHead, BaseAsteroids))),
+    sdl_delta_decode(BaseHead, HeadDelta, Head),
+    fast_term_serialized(head(Ship, Peer, Bullets), Head),
+    maplist(apply_record(BaseAsteroids), Records, Known),
+    !,
+    list_to_assoc(Known, KnownAsteroids),
+    % The server never again encodes against anything older than BaseSeq.
+    put_assoc(Seq, Net.received, known(Head, KnownAsteroids), Received0),
+    prune_history(BaseSeq, Received0, ReceivedHistory),
+    Latency is Net.latency + Received - Sent,
+    (Echo > 0
+        -> Rtt is Net.rtt + Received - Echo,
+           RttSamples is Net.rtt_samples + 1
+        ;  Rtt = Net.rtt,
+           RttSamples = Net.rtt_samples),
+    Total is Net.bytes + Size,
+    Snapshots is Net.snapshots + 1,
+    NextNet = Net.put(_{
+        acked: Seq,
+        snapshots: Snapshots,
+        received: ReceivedHistory,
+        prev: Net.latest,
+        latest: snap(Received, world(Ship, Peer, Bullets, Known)),
+        bytes: Total,
+        latency: Latency,
+        rtt: Rtt,
+        rtt_samples: RttSamples
+    }).
+
+client_receive(_, Net, Net).
+
+client_view(_, State, Net, State) :-
+    Net.latest = none,
+    !.
+
+client_view(Now, State, Net, View) :-
+    snap(Latest, world(Peer0, Ship0, Bullets0, Asteroids0)) = Net.latest,
+    dequantize_ship(Ship0, Ship),
+    dequantize_ship(Peer0, Peer),
+    maplist(dequantize_bullet, Bullets0, Bullets),
+    maplist(dequantize_asteroid, Asteroids0, Asteroids),
+    % Draw one snapshot interval behind, between the previous and latest.
+    (Net.prev = snap(Prev, world(PrevPeer0, _, PrevBullets0, PrevAsteroids0))
+        -> Interval is max(Latest - Prev, 0.001),
+           T is min(1, (Now - Latest) / Interval),
+           dequantize_ship(PrevPeer0, PrevPeer),
+           maplist(dequantize_bullet, PrevBullets0, PrevBullets),
+           maplist(dequantize_asteroid, PrevAsteroids0, PrevAsteroids),
+           lerp_ship(T, PrevPeer, Peer, ViewPeer),
+           lerp_list(T, PrevBullets, Bullets, ViewBullets),
+           lerp_asteroids(T, PrevAsteroids, Asteroids, ViewAsteroids)
+        ;  ViewPeer = Peer,
+           ViewBullets = Bullets,
+           ViewAsteroids = Asteroids),
+    % Our own ship runs ahead of the server using the controls held locally.
+    Ahead is Now - Latest,
+    Controlled = Ship.put(_{turn: State.ship.turn, accel: State.ship.accel}),
+    update_ship(State, Ahead, Controlled, Predicted),
+    View = State.put(_{
+        ship: Predicted,
+        peer: ViewPeer,
+        bullets: ViewBullets,
+        asteroids: ViewAsteroids,
+        time: Now
+    }).
+
+lerp_vec2(T, vec2(X0, Y0), vec2(X1, Y1), vec2(X, Y)) :-
+    (abs(X1 - X0) + abs(Y1 - Y0) > 100
+        -> % wrapped across the screen edge
+           X = X1,
+           Y = Y1
+        ;  X is X0 + (X1 - X0) * T,
+           Y is Y0 + (Y1 - Y0) * T).
+
+lerp_entity(T, E0, E1, E) :-
+    lerp_vec2(T, E0.pos, E1.pos, Pos),
+    E = E1.put(pos, Pos).
+
+lerp_ship(_, none, Ship, Ship) :- !.
+
+lerp_ship(_, _, none, none) :- !.
+
+lerp_ship(T, Ship0, Ship1, Ship) :-
+    lerp_entity(T, Ship0, Ship1, Ship).
+
+% Bullets carry no id, so only lists of the same length are interpolated.
+lerp_list(T, L0, L1, L) :-
+    (same_length(L0, L1)
+        -> maplist(lerp_entity(T), L0, L1, L)
+        ;  L = L1).
+
+% Asteroids are matched by id; new ones, such as the halves of a split, are
+% drawn where the latest snapshot has them.
+lerp_asteroids(T, As0, As1, As) :-
+    findall(Id-A, (member(A, As0), get_dict(id, A, Id)), Pairs),
+    list_to_assoc(Pairs, Prev),
+    maplist(lerp_asteroid(T, Prev), As1, As).
+
+lerp_asteroid(T, Prev, A1, A) :-
+    (get_assoc(A1.id, Prev, A0)
+        -> lerp_entity(T, A0, A1, A)
+        ;  A = A1).
+
+% Scripted input for running the client unattended (--autopilot).
+autopilot_events(Net, Events) :-
+    (Net.autopilot = true
+        -> Tick = Net.ticks,
+           findall(Event, autopilot_event(Tick, Event), Events)
+        ;  Events = []).
+
+autopilot_event(T, key("Space", down, initial)) :- T mod 20 =:= 0.
+autopilot_event(T, key("Left", down, initial)) :- T mod 120 =:= 0.
+autopilot_event(T, key("Left", up, initial)) :- T mod 120 =:= 30.
+autopilot_event(T, key("Up", down, initial)) :- T mod 90 =:= 45.
+autopilot_event(T, key("Up", up, initial)) :- T mod 90 =:= 60.
+
+%% Reporting
+
+net_report(Net) :-
+    Ticks = Net.ticks,
+    (Ticks > 0 -> PerTick is Net.bytes / Ticks ; PerTick = 0),
+    format("~w: ~d ticks, ~1f bytes/tick~n", [Net.role, Ticks, PerTick]),
+    (Net.role = server
+        -> format("server: ~d snapshots too large to send~n", [Net.dropped])
+        ;  true),
+    (Net.role = client, Net.snapshots > 0
+        -> Latency is 1000 * Net.latency / Net.snapshots,
+           format("client: snapshot latency ~2f ms~n", [Latency]),
+           (Net.rtt_samples > 0
+               -> Rtt is 1000 * Net.rtt / Net.rtt_samples,
+                  format("client: input round trip ~2f ms~n", [Rtt])
+               ;  true)
+        ;  true).
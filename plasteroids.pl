@@ -1,7 +1,12 @@
 :- consult(vector).
 :- consult(geometry).
+:- consult(net).
 :- use_foreign_library(sdl).
 
+:- multifile term_expansion/2.
+
+screen_size(640, 480).
+
 deg_rad(Deg, Rad) :-
     Rad is Deg * 2 * pi / 360.
 
@@ -55,25 +60,18 @@ update_ship(State, Delta, Ship, NextShip) :-
 
 pair([A,B], A, B).
 
-pairs(_, [], Tail, Tail).
-
-pairs(A, [B|Bs], [Pair|Pairs], Tail) :-
-    Pair = [A,B],
-    pairs(A, Bs, Pairs, Tail).
-
-cartesian_product([], _, Tail, Tail).
-
-cartesian_product([A|As], Bs, Pairs, Tail) :-
-    pairs(A, Bs, APairs, Tail),
-    cartesian_product(As, Bs, Pairs, APairs),
-    !.
-
-cartesian_product(As, Bs, Pairs) :-
-    cartesian_product(As, Bs, Pairs, []).
-
+% The bounding circle rejects almost every pair before the polygon is built.
 is_collision(Bullet, Asteroid) :-
+    asteroid_near(Asteroid, Bullet.pos),
     asteroid_polygon(Asteroid, Polygon),
-    in_polygon(Bullet.pos, Asteroid.pos, Polygon).
+    in_polygon(Bullet.pos, Polygon).
+
+asteroid_near(Asteroid, vec2(X, Y)) :-
+    asteroid_radius(Asteroid, Radius),
+    vec2(AX, AY) = Asteroid.pos,
+    DX is X - AX,
+    DY is Y - AY,
+    DX * DX + DY * DY =< Radius * Radius.
 
 split_asteroid(Asteroid, SplitAsteroids) :-
     NextSize is Asteroid.size / 2,
@@ -87,12 +85,21 @@ split_asteroid(Asteroid, SplitAsteroids) :-
         ), SplitAsteroids)
     ).
 
-check_bullet_asteroid_collisions(Bullets, Asteroids, Nbs, Nas) :-
-    cartesian_product(Bullets, Asteroids, Pairs),
-    partition(apply(is_collision), Pairs, Hits, _),
+explode_asteroid(State, Asteroid) :-
+    Count is round(Asteroid.size * 20),
+    Speed is 40 + Asteroid.size * 2,
+    vec2_polar(Vel, Asteroid.vel),
+    sdl_particles_spawn(State.debris, Asteroid.pos, Vel, burst(Count, Speed, 1.2)),
+    play_sound(State, explosion).
+
+check_bullet_asteroid_collisions(State, Bullets, Asteroids, Nbs, Nas) :-
+    findall([Bullet, Asteroid],
+            (member(Bullet, Bullets), member(Asteroid, Asteroids), is_collision(Bullet, Asteroid)),
+            Hits),
     maplist(pair, Hits, HitBullets, HitAsteroids),
     subtract(Bullets, HitBullets, Nbs),
     subtract(Asteroids, HitAsteroids, LiveAsteroids),
+    maplist(explode_asteroid(State), HitAsteroids),
     maplist(split_asteroid, HitAsteroids, SplitAsteroids),
     flatten(SplitAsteroids, NewAsteroids),
     append(LiveAsteroids, NewAsteroids, Nas).
@@ -100,11 +107,22 @@ check_bullet_asteroid_collisions(Bullets, Asteroids, Nbs, Nas) :-
 update_state(_, _, quit, quit).
 
 update_state(Now, Delta, State, NextState) :-
+    (State.rewinding = true, State.rewind \= none
+        -> rewind_state(Now, State, NextState)
+        ;  simulate_state(Now, Delta, State, NextState),
+           record_snapshot(NextState)).
+
+simulate_state(Now, Delta, State, NextState) :-
     Ship = State.ship,
     Bullets = State.bullets,
     Asteroids = State.asteroids,
-    check_bullet_asteroid_collisions(Bullets, Asteroids, HitBullets, HitAsteroids),
+    check_bullet_asteroid_collisions(State, Bullets, Asteroids, HitBullets, HitAsteroids),
     update_ship(State, Delta, Ship, NextShip),
+    update_peer(State, Delta, State.peer, NextPeer),
+    emit_exhaust(State.exhaust, Delta, NextShip),
+    emit_exhaust(State.exhaust, Delta, NextPeer),
+    sdl_particles_update(State.debris, Delta),
+    sdl_particles_update(State.exhaust, Delta),
     include(bullet_alive(State), HitBullets, LiveBullets),
     maplist(update_bullet(State, Delta), LiveBullets, NextBullets),
     maplist(update_asteroid(State, Delta), HitAsteroids, NextAsteroids),
@@ -112,25 +130,65 @@ update_state(Now, Delta, State, NextState) :-
         bullets: NextBullets,
         asteroids: NextAsteroids,
         ship: NextShip,
+        peer: NextPeer,
         time: Now
     }).
 
+% The second player's ship in two-player mode, or none.
+update_peer(_, _, none, none) :- !.
+
+update_peer(State, Delta, Peer, NextPeer) :-
+    update_ship(State, Delta, Peer, NextPeer).
+
+% Snapshots hold only what the simulation changes; stars, particle pools and
+% sounds are shared by every snapshot and stay out of the rewind buffer.
+record_snapshot(State) :-
+    get_dict(rewind, State, none),
+    !.
+
+record_snapshot(State) :-
+    Snapshot = snapshot(State.time, State.ship, State.peer, State.bullets, State.asteroids),
+    fast_term_serialized(Snapshot, Bytes),
+    sdl_rewind_push(State.rewind, Bytes).
+
+% Steps back one snapshot per tick while rewinding. Bullet expiry is absolute
+% time, so it is shifted forward by however long ago the snapshot was taken.
+rewind_state(Now, State, NextState) :-
+    (sdl_rewind_pop(State.rewind, Bytes)
+        -> fast_term_serialized(snapshot(Then, Ship, Peer, Bullets, Asteroids), Bytes),
+           Offset is Now - Then,
+           maplist(shift_expiry(Offset), Bullets, ShiftedBullets),
+           NextState = State.put(_{
+               ship: Ship,
+               peer: Peer,
+               bullets: ShiftedBullets,
+               asteroids: Asteroids,
+               time: Now
+           })
+        ;  NextState = State.put(time, Now)).
+
+shift_expiry(Offset, Bullet, Shifted) :-
+    Expiry is Bullet.expiry + Offset,
+    Shifted = Bullet.put(expiry, Expiry).
+
 in_bounds(rect(vec2(L, T), vec2(R, B)), vec2(X, Y)) :-
     L =< X,
     X < R,
     T =< Y,
     Y < B.
 
+% Once the bounds are wholly past one edge, moves them by the screen size
+% plus their own size, so they re-enter overlapping the opposite edge.
 wrap_bounds(rect(vec2(OutL, OutT), vec2(OutR, OutB)), rect(vec2(InL, InT), vec2(InR, InB)), vec2(X, Y), vec2(WrapX, WrapY)) :-
     (InR < OutL
         -> WrapX is OutR - OutL + X + InR - InL
         ; InL > OutR
-            -> WrapX is OutR + OutL + X - InR - InL
+            -> WrapX is X - (OutR - OutL) - (InR - InL)
             ; WrapX = X),
     (InB < OutT 
         -> WrapY is OutB - OutT + Y + InB - InT
         ; InT > OutB
-            -> WrapY is OutB + OutT + Y - InB - InT
+            -> WrapY is Y - (OutB - OutT) - (InB - InT)
             ; WrapY = Y).
 
 handle_input(key("Right", down, initial), State, InputState) :-
@@ -160,6 +218,7 @@ handle_input(key("Left", up, initial), State, InputState) :-
     }).
 
 handle_input(key("Up", down, initial), State, InputState) :-
+    play_sound(State, thrust),
     InputState = State.put(_{
         ship: State.ship.put(_{accel: true})
     }).
@@ -171,10 +230,17 @@ handle_input(key("Up", up, initial), State, InputState) :-
 
 handle_input(key("Space", down, initial), State, InputState) :-
     make_bullet(State.ship, Bullet),
+    play_sound(State, fire),
     InputState = State.put(_{
         bullets: [Bullet|State.bullets]
     }).
 
+handle_input(key("Backspace", down, initial), State, InputState) :-
+    InputState = State.put(rewinding, true).
+
+handle_input(key("Backspace", up, initial), State, InputState) :-
+    InputState = State.put(rewinding, false).
+
 handle_input(quit, _, quit).
 
 handle_input(_, quit, quit).
@@ -187,29 +253,231 @@ draw_state(Renderer, State) :-
     Now = State.time,
     Stars = State.stars,
     maplist(draw_star(Now, Renderer), Stars),
+    sdl_draw_particles(Renderer, State.exhaust),
+    sdl_draw_particles(Renderer, State.debris),
     Ship = State.ship,
     draw_ship(Renderer, Ship),
+    (State.peer = none -> true ; draw_ship(Renderer, State.peer)),
     Asteroids = State.asteroids,
-    maplist(draw_asteroid(Renderer), Asteroids),
+    draw_asteroids(Renderer, State.bounds, Asteroids),
     Bullets = State.bullets,
     maplist(draw_bullet(Renderer), Bullets),
+    capture_frame(Renderer, State.capture),
     sdl_render_present(Renderer).
 
+% The pixels are read back before sdl_render_present, after which the back
+% buffer contents are undefined.
+capture_frame(_, none) :- !.
+capture_frame(Renderer, Capture) :-
+    sdl_capture_frame(Capture, Renderer).
+
 process_input(quit, quit).
 
 process_input(State, NextState) :-
     sdl_poll_events(Events),
     foldl(handle_input, Events, State, NextState).
 
-event_loop(_, _, quit).
+event_loop(_, _, quit, _, _).
 
-event_loop(Then, Renderer, State) :-
+event_loop(Then, Renderer, State, Sched, Timer) :-
     draw_state(Renderer, State),
+    gc_slack(Then, Sched, NextSched),
+    frame_pace(Then, NextSched),
     process_input(State, InputState),
     get_time(Now),
     Delta is Now - Then,
+    frame_tick(State, Delta, Timer, NextTimer),
     update_state(Now, Delta, InputState, UpdatedState),
-    event_loop(Now, Renderer, UpdatedState).
+    event_loop(Now, Renderer, UpdatedState, NextSched, NextTimer).
+
+% With --stress or --frame_stats, the average and worst frame times are
+% printed once a second.
+frame_timer(Options, Timer) :-
+    (option(stress(_), Options) ; option(frame_stats(true), Options)),
+    !,
+    frame_window(Timer).
+
+frame_timer(_, none).
+
+frame_window(frames{count: 0, total: 0, worst: 0}).
+
+frame_tick(_, _, none, none) :- !.
+
+frame_tick(State, Delta, Timer, NextTimer) :-
+    Count is Timer.count + 1,
+    Total is Timer.total + Delta,
+    Worst is max(Timer.worst, Delta),
+    (Total >= 1
+        -> length(State.asteroids, Asteroids),
+           Average is Total / Count * 1000,
+           WorstMs is Worst * 1000,
+           Fps is Count / Total,
+           format(user_error, "frame: ~2f ms avg, ~2f ms worst, ~1f fps, ~d asteroids~n",
+                  [Average, WorstMs, Fps, Asteroids]),
+           frame_window(NextTimer)
+        ;  NextTimer = Timer.put(_{count: Count, total: Total, worst: Worst})).
+
+%% Garbage collection scheduling
+%
+% The dict copies made every frame leave a steady stream of garbage on the
+% global stack. Left to itself the collector runs whenever the stack fills,
+% which is usually somewhere in the middle of update_state/4. Instead the
+% scheduler raises the global stack's min_free to the hard limit, so the
+% stack grows rather than collecting until that much garbage has piled up,
+% and collects right after sdl_render_present once garbage passes the soft
+% limit, but only when the frame finished early enough for the expected
+% collection time to fit in what is left of it. Past the hard limit
+% SWI-Prolog collects on its own as usual. The gc flag is left alone, since
+% turning it off would also stop the stacks from growing.
+%
+% The loop then sleeps out the rest of the frame, so slack is real idle time
+% rather than a head start on the next frame; --no-pace turns that off.
+%
+% With --gc_trace, global stack growth and size, growth of the allocated
+% trail, stack shifts, collections and slack are printed once a second. --no-gc_schedule leaves collection to
+% SWI-Prolog while still reporting.
+
+frame_budget(Budget) :-
+    Budget is 1 / 60.
+
+gc_soft_limit(Bytes) :-
+    Bytes is 16 * 1024 * 1024.
+
+gc_hard_limit(Bytes) :-
+    Bytes is 128 * 1024 * 1024.
+
+gc_trace_frames(60).
+
+gc_scheduler(Options, Sched) :-
+    option(gc_schedule(Enabled), Options, true),
+    option(gc_trace(Trace), Options, false),
+    option(pace(Pace), Options, true),
+    (Enabled = true
+        -> gc_hard_limit(Hard),
+           set_prolog_stack(global, min_free(Hard))
+        ;  true),
+    statistics(globalused, Global),
+    statistics(trail, Trail),
+    statistics(garbage_collection, [Gcs|_]),
+    gc_window(Window),
+    Sched = gc{
+        enabled: Enabled,
+        trace: Trace,
+        pace: Pace,
+        global: Global,
+        trail: Trail,
+        gcs: Gcs,
+        live: Global,
+        estimate: 0.002,
+        window: Window
+    }.
+
+gc_window(window{frames: 0, growth: 0, growth_max: 0, trail_growth: 0, trail_growth_max: 0,
+                  shifts: 0, gcs: 0, scheduled: 0, gc_ms: 0, slack: 0}).
+
+stack_shifts(Shifts) :-
+    statistics(global_shifts, Global),
+    statistics(trail_shifts, Trail),
+    Shifts is Global + Trail.
+
+gc_slack(FrameStart, Sched, NextSched) :-
+    get_time(Now),
+    frame_budget(Budget),
+    Slack is Budget - (Now - FrameStart),
+    statistics(globalused, Global),
+    statistics(trail, Trail),
+    statistics(garbage_collection, [Count0, _, Ms0|_]),
+    stack_shifts(Shifts0),
+    Growth is max(0, Global - Sched.global),
+    TrailGrowth is max(0, Trail - Sched.trail),
+    % A collection SWI-Prolog ran on its own since the last frame leaves live
+    % stale, so everything allocated since would count as garbage.
+    (Count0 =\= Sched.gcs
+        -> Current = Sched.put(live, Global)
+        ;  Current = Sched),
+    Garbage is Global - Current.live,
+    gc_decision(Current, Slack, Garbage, Decision),
+    gc_collect(Decision, Current, Collected),
+    statistics(globalused, After),
+    statistics(trail, TrailAfter),
+    statistics(garbage_collection, [Count1, _, Ms1|_]),
+    stack_shifts(Shifts1),
+    W = Sched.window,
+    (Decision = slack -> Scheduled is W.scheduled + 1 ; Scheduled = W.scheduled),
+    Frames is W.frames + 1,
+    GrowthSum is W.growth + Growth,
+    GrowthMax is max(W.growth_max, Growth),
+    TrailGrowthSum is W.trail_growth + TrailGrowth,
+    TrailGrowthMax is max(W.trail_growth_max, TrailGrowth),
+    ShiftSum is W.shifts + Shifts1 - Shifts0,
+    Gcs is W.gcs + Count1 - Count0,
+    GcMs is W.gc_ms + Ms1 - Ms0,
+    SlackSum is W.slack + Slack,
+    Window = W.put(_{
+        frames: Frames,
+        growth: GrowthSum,
+        growth_max: GrowthMax,
+        trail_growth: TrailGrowthSum,
+        trail_growth_max: TrailGrowthMax,
+        shifts: ShiftSum,
+        gcs: Gcs,
+        scheduled: Scheduled,
+        gc_ms: GcMs,
+        slack: SlackSum
+    }),
+    gc_report(Collected.put(_{global: After, trail: TrailAfter, gcs: Count1, window: Window}), NextSched).
+
+gc_decision(Sched, _, _, none) :-
+    Sched.enabled \= true,
+    !.
+
+gc_decision(Sched, Slack, Garbage, slack) :-
+    gc_soft_limit(Soft),
+    Garbage > Soft,
+    Slack > Sched.estimate,
+    !.
+
+gc_decision(_, _, _, none).
+
+gc_collect(none, Sched, Sched) :- !.
+
+gc_collect(slack, Sched, NextSched) :-
+    get_time(Start),
+    garbage_collect,
+    get_time(End),
+    statistics(globalused, Live),
+    % Smoothed so one unusually long or short collection doesn't skew it
+    Estimate is 0.7 * Sched.estimate + 0.3 * (End - Start),
+    NextSched = Sched.put(_{live: Live, estimate: Estimate}).
+
+% Sleeps until the frame budget from FrameStart is used up.
+frame_pace(FrameStart, Sched) :-
+    (Sched.pace = true
+        -> get_time(Now),
+           frame_budget(Budget),
+           Remaining is Budget - (Now - FrameStart),
+           (Remaining > 0 -> sleep(Remaining) ; true)
+        ;  true).
+
+gc_report(Sched, NextSched) :-
+    W = Sched.window,
+    gc_trace_frames(Frames),
+    (W.frames >= Frames
+        -> (Sched.trace = true
+               -> Growth is W.growth / W.frames / 1024,
+                  GrowthMax is W.growth_max / 1024,
+                  statistics(global, Allocated),
+                  GlobalMb is Allocated / (1024 * 1024),
+                  TrailGrowth is W.trail_growth / W.frames / 1024,
+                  TrailGrowthMax is W.trail_growth_max / 1024,
+                  TrailMb is Sched.trail / (1024 * 1024),
+                  Slack is W.slack / W.frames * 1000,
+                  format(user_error, "gc: global +~1f KB/frame (max ~1f KB), stack ~1f MB, trail +~1f KB/frame (max ~1f KB), ~1f MB, ~d shifts, ~d collections (~d scheduled) ~0f ms, slack ~2f ms/frame~n",
+                         [Growth, GrowthMax, GlobalMb, TrailGrowth, TrailGrowthMax, TrailMb, W.shifts, W.gcs, W.scheduled, W.gc_ms, Slack])
+               ;  true),
+           gc_window(Window),
+           NextSched = Sched.put(window, Window)
+        ;  NextSched = Sched).
 
 initial_star(Star, Width, Height) :-
     random_between(50, 150, R),
@@ -226,6 +494,14 @@ random_between(Low, Hi, Val) :-
     random(X),
     Val is floor((Hi + 1 - Low) * X + Low).
 
+% The starfield is generated once at compile time and baked into the saved
+% state, so startup doesn't build 401 star dicts.
+term_expansion(baked_stars, baked_stars(Width, Height, Stars)) :-
+    screen_size(Width, Height),
+    findall(Star, (between(0, 400, _), initial_star(Star, Width, Height)), Stars).
+
+baked_stars.
+
 draw_star(Time, Renderer, Star) :-
     random_between(0, 100, Ra),
     random_between(0, 100, Ga),
@@ -261,6 +537,17 @@ ship_right(Ship, WingPos) :-
 ship_back(Ship, ExhaustPos) :-
     vec2_eval(ExhaustPos, Ship.pos + scale(Ship.size * 1 / 4, unit_rad(Ship.dir + pi))).
 
+emit_exhaust(_, _, none) :- !.
+
+emit_exhaust(Exhaust, Delta, Ship) :-
+    (Ship.accel = true ->
+        Count is max(1, round(Delta * 300)),
+        Dir is Ship.dir + pi,
+        Spread is pi / 6,
+        ship_back(Ship, Pos),
+        sdl_particles_spawn(Exhaust, Pos, Ship.vel, cone(Count, Dir, Spread, 80, 0.4))
+    ; true).
+
 draw_ship(Renderer, Ship) :-
     HalfSize is round(Ship.size / 2),
     ship_front(Ship, ShipFront),
@@ -315,18 +602,6 @@ make_bullet(Ship, Bullet) :-
     }.
 
 
-draw_polygon(Renderer, [A,B|Rest]) :-
-    sdl_draw(Renderer, line(A, B)),
-    draw_polygon(Renderer, A, [B|Rest]).
-
-draw_polygon(Renderer, Initial, [End]) :-
-    sdl_draw(Renderer, line(End, Initial)).
-
-draw_polygon(Renderer, Terminal, [P,G|T]) :-
-    sdl_draw(Renderer, line(P, G)),
-    draw_polygon(Renderer, Terminal, [G|T]),
-    !.
-
 initial_asteroid_point(NumPoints, N, Point) :-
     random(Dist),
     Distance is Dist * 0.5 + 0.75,
@@ -338,7 +613,13 @@ initial_asteroid_point(NumPoints, N, Point) :-
 initial_asteroid_points(NumPoints, Points) :-
     findall(Point, (between(1, NumPoints, N), initial_asteroid_point(NumPoints, N, Point)), Points).
 
+% Ids are unique for the life of the process, so the network code can match
+% an asteroid across snapshots even after others split or vanish.
+next_asteroid_id(Id) :-
+    flag(asteroid_id, Id, Id + 1).
+
 make_asteroid(Size, Width, Height, Asteroid) :-
+    next_asteroid_id(Id),
     random_between(0, 360, Deg),
     deg_rad(Deg, Rad),
     Speed = 15,
@@ -349,6 +630,7 @@ make_asteroid(Size, Width, Height, Asteroid) :-
     random_between(10, 15, NumPoints),
     initial_asteroid_points(NumPoints, Points),
     Asteroid = asteroid{
+        id: Id,
         size: Size,
         pos: vec2(X, Y),
         points: Points,
@@ -360,18 +642,68 @@ make_asteroid(Size, Width, Height, Asteroid) :-
 asteroid_polygon(Asteroid, Points) :-
     maplist(asteroid_point_vec2(Asteroid.rot, Asteroid.size, Asteroid.pos), Asteroid.points, Points).
 
-asteroid_bounds(Asteroid, Bounds) :-
-    asteroid_polygon(Asteroid, Points),
-    polygon_bounds(Points, Bounds).
+% Outline points lie between 0.75 and 1.25 sizes from the center (see
+% initial_asteroid_point/3), so this circle always contains the polygon.
+asteroid_radius(Asteroid, Radius) :-
+    Radius is Asteroid.size * 1.25.
+
+asteroid_bounds(Asteroid, rect(vec2(Left, Top), vec2(Right, Bottom))) :-
+    asteroid_radius(Asteroid, Radius),
+    vec2(X, Y) = Asteroid.pos,
+    Left is X - Radius,
+    Top is Y - Radius,
+    Right is X + Radius,
+    Bottom is Y + Radius.
+
+asteroid_visible(rect(vec2(L, T), vec2(R, B)), Asteroid) :-
+    asteroid_bounds(Asteroid, rect(vec2(Left, Top), vec2(Right, Bottom))),
+    Right >= L,
+    Left < R,
+    Bottom >= T,
+    Top < B.
 
 asteroid_point_vec2(Rot, Size, Pos, Polar, Vec) :-
     polar_eval(RotatedScaled, (Polar + polar(0, Rot)) * scalar(Size)),
     vec2_polar(RotatedScaledPos, RotatedScaled),
     vec2_eval(Vec, Pos + RotatedScaledPos).
 
-draw_asteroid(Renderer, Asteroid) :-
+% Level of detail picked from the on-screen radius in pixels.
+asteroid_lod(Radius, point) :- Radius < 1.5, !.
+asteroid_lod(Radius, quad) :- Radius < 4, !.
+asteroid_lod(Radius, coarse) :- Radius < 12, !.
+asteroid_lod(_, full).
+
+every_other([], []).
+every_other([A], [A]).
+every_other([A,_|Rest], [A|Others]) :-
+    every_other(Rest, Others).
+
+% asteroid_shapes(+Asteroid, -Shapes, ?Tail): difference list of sdl_draw_many
+% shapes for one asteroid.
+asteroid_shapes(Asteroid, Shapes, Tail) :-
+    asteroid_radius(Asteroid, Radius),
+    asteroid_lod(Radius, Lod),
+    asteroid_shapes(Lod, Asteroid, Shapes, Tail).
+
+asteroid_shapes(point, Asteroid, [Pos|Tail], Tail) :-
+    Pos = Asteroid.pos.
+
+asteroid_shapes(quad, Asteroid, [fill(Bounds)|Tail], Tail) :-
+    asteroid_bounds(Asteroid, Bounds).
+
+asteroid_shapes(coarse, Asteroid, Shapes, Tail) :-
+    every_other(Asteroid.points, Coarse),
+    asteroid_shapes(full, Asteroid.put(points, Coarse), Shapes, Tail).
+
+asteroid_shapes(full, Asteroid, Shapes, Tail) :-
     asteroid_polygon(Asteroid, Points),
-    draw_polygon(Renderer, Points).
+    polygon_lines(Points, Lines),
+    append(Lines, Tail, Shapes).
+
+draw_asteroids(Renderer, ScreenBounds, Asteroids) :-
+    include(asteroid_visible(ScreenBounds), Asteroids, Visible),
+    foldl(asteroid_shapes, Visible, Shapes, []),
+    sdl_draw_many(Renderer, [rgba(255, 255, 255, 255)|Shapes]).
 
 update_asteroid(State, Delta, Asteroid, NextAsteroid) :-
     vec2_polar(Vel, Asteroid.vel),
@@ -386,31 +718,157 @@ update_asteroid(State, Delta, Asteroid, NextAsteroid) :-
     }).
 
 initial_state(State) :-
-    Width = 640,
-    Height = 480,
-    findall(Star, (between(0, 400, _), initial_star(Star, Width, Height)), Stars),
+    initial_state(5, 30, State).
+
+% Stress scenario: many small asteroids, mostly drawn at reduced detail.
+% Level of detail and culling only bound the drawing. Every asteroid is
+% still simulated in Prolog each frame, so update_asteroid/4 sets the real
+% ceiling: the update_asteroids_1000 and draw_asteroids_20k cases in
+% bench.pl give the two costs separately, and `make bench-stress` the
+% frame times of the whole game.
+stress_state(Count, State) :-
+    initial_state(Count, 2, State).
+
+initial_state(NumAsteroids, AsteroidSize, State) :-
+    screen_size(Width, Height),
+    baked_stars(Width, Height, Stars),
     initial_ship(Ship, Width, Height),
-    findall(Asteroid, (between(1, 5, _), make_asteroid(30, Width, Height, Asteroid)), Asteroids),
+    findall(Asteroid, (between(1, NumAsteroids, _), make_asteroid(AsteroidSize, Width, Height, Asteroid)), Asteroids),
+    sdl_create_particles(65536, rgba(200, 200, 200, 255), Debris),
+    sdl_create_particles(4096, rgba(255, 160, 0, 255), Exhaust),
     get_time(When),
     State = state{
         stars: Stars,
+        debris: Debris,
+        sounds: sounds{},
+        rewind: none,
+        rewinding: false,
+        exhaust: Exhaust,
         bullets: [],
         asteroids: Asteroids,
         ship: Ship,
+        peer: none,
+        capture: none,
         time: When,
         dim: vec2(Width, Height),
         bounds: rect(vec2(0, 0), vec2(Width, Height))
     }.
 
-main(_) :-
+% Audio is optional: without a usable device the game runs silently. Set
+% SDL_AUDIODRIVER=dummy (or disk) to exercise the mixer without hardware.
+load_sounds(Options, Sounds) :-
+    option(voices(Voices), Options, 16),
+    option(polyphony(Polyphony), Options, 4),
+    (sdl_init([audio]), sdl_open_audio([voices(Voices), polyphony(Polyphony)])
+        -> sdl_synth_sound(tone(880, 0.12, 30), Fire),
+           sdl_synth_sound(noise(0.3, 10), Thrust),
+           sdl_synth_sound(noise(0.9, 5), Explosion),
+           Sounds = sounds{fire: Fire, thrust: Thrust, explosion: Explosion}
+        ;  Sounds = sounds{}).
+
+% With --offscreen the game renders into a software surface and needs no
+% display, which together with --capture suits headless recording.
+create_target(Options, Width, Height, none, Renderer) :-
+    option(offscreen(true), Options), !,
+    sdl_init([events]),
+    sdl_create_renderer(offscreen(Width, Height), [], Renderer).
+
+create_target(_, Width, Height, Window, Renderer) :-
     sdl_init([video]),
-    initial_state(State),
-    vec2(Width, Height) = State.dim,
     sdl_create_window("SDL Test", Width, Height, [], Window),
-    sdl_create_renderer(Window, [software], Renderer),
+    sdl_create_renderer(Window, [software], Renderer).
+
+% --capture=Prefix writes every frame to Prefix000000.ppm and on, and
+% --capture_raw=File appends raw RGB24 frames to File. Frames are written on
+% a background thread; when it falls behind they are dropped, not waited for.
+start_capture(Options, Renderer, Capture) :-
+    option(capture_buffers(Buffers), Options, 8),
+    (option(capture(Prefix), Options)
+        -> sdl_start_capture(Renderer, ppm(Prefix), Buffers, Capture)
+    ; option(capture_raw(File), Options)
+        -> sdl_start_capture(Renderer, raw(File), Buffers, Capture)
+    ;  Capture = none).
+
+stop_capture(none) :- !.
+stop_capture(Capture) :-
+    sdl_stop_capture(Capture),
+    sdl_capture_stats(Capture, capture_stats(Frames, Written, Dropped, Failed)),
+    format(user_error, "capture: ~d frames, ~d written, ~d dropped, ~d failed~n",
+           [Frames, Written, Dropped, Failed]).
+
+play_sound(State, Name) :-
+    (get_dict(Name, State.sounds, Sound)
+        -> sdl_play_sound(Sound, 0.8)
+        ;  true).
+
+% With --profile_startup, prints the time since process start at each phase
+% of startup up to the first presented frame.
+startup_mark(Options, Phase) :-
+    (option(profile_startup(true), Options)
+        -> statistics(epoch, Epoch),
+           get_time(Now),
+           Elapsed is (Now - Epoch) * 1000,
+           format(user_error, "startup: ~w~t~20| ~1f ms~n", [Phase, Elapsed])
+        ;  true).
+
+% Recording snapshots costs a serialization and a delta every tick, so the
+% rewind buffer only exists with --rewind=Seconds. It holds one snapshot per
+% tick at 60 FPS, capped at 64MB.
+rewind_buffer(Options, Rewind) :-
+    option(rewind(Seconds), Options),
+    Seconds > 0,
+    !,
+    Entries is max(1, round(Seconds * 60)),
+    RewindBytes is 64 * 1024 * 1024,
+    sdl_create_rewind(Entries, RewindBytes, Rewind).
+
+rewind_buffer(_, none).
+
+% Runs on its own thread so the initial state is built while SDL starts up.
+% Always answers, so main/1 never waits forever on a failed build.
+build_state(Main, Options) :-
+    (catch(
+        ((option(stress(Count), Options)
+            -> stress_state(Count, InitialState)
+            ;  initial_state(InitialState)),
+         rewind_buffer(Options, Rewind),
+         State = InitialState.put(rewind, Rewind),
+         Result = state(State)),
+        Error,
+        Result = error(Error))
+        -> true
+        ;  Result = error(failed(build_state))),
+    thread_send_message(Main, built_state(Result)).
+
+main(Argv) :-
+    argv_options(Argv, _, Options),
+    startup_mark(Options, main),
+    thread_self(Main),
+    thread_create(build_state(Main, Options), Builder, []),
+    screen_size(Width, Height),
+    create_target(Options, Width, Height, Window, Renderer),
+    load_sounds(Options, Sounds),
     sdl_render_blendmode(Renderer, alpha),
-    get_time(Now),
-    once(event_loop(Now, Renderer, State)),
+    start_capture(Options, Renderer, Capture),
+    startup_mark(Options, sdl_ready),
+    thread_get_message(built_state(Result)),
+    thread_join(Builder, _),
+    (Result = error(Error) -> throw(Error) ; Result = state(InitialState)),
+    State = InitialState.put(_{sounds: Sounds, capture: Capture}),
+    startup_mark(Options, state_ready),
+    (option(serve(Port), Options)
+        -> net_serve(Port, Options, Renderer, State)
+    ; option(connect(Port), Options)
+        -> net_connect(Port, Options, Renderer, State)
+    ;  draw_state(Renderer, State),
+       startup_mark(Options, first_frame),
+       (option(exit_after_first_frame(true), Options)
+           -> true
+           ;  gc_scheduler(Options, Sched),
+              frame_timer(Options, Timer),
+              get_time(Now),
+              once(event_loop(Now, Renderer, State, Sched, Timer)))),
+    stop_capture(Capture),
     sdl_destroy_renderer(Renderer),
-    sdl_destroy_window(Window),
+    (Window = none -> true ; sdl_destroy_window(Window)),
     sdl_terminate.
@@ -24,16 +24,23 @@
 #include <SWI-Prolog.h>
 #include <stdio.h>
 #include <math.h>
+#include <stdatomic.h>
 
 PL_blob_t sdl_blob;
 
 
 const int KIND_WINDOW = 0;
 const int KIND_RENDERER = 1;
+const int KIND_PARTICLES = 2;
+const int KIND_REWIND = 3;
+const int KIND_CAPTURE = 4;
 
 const char *KIND_NAMES[] = {
     "WINDOW",
     "RENDERER",
+    "PARTICLES",
+    "REWIND",
+    "CAPTURE",
 };
 
 typedef int object_kind;
@@ -42,8 +49,16 @@ typedef struct {
     object_kind kind;
     ssize_t refs;
     void *object;
+    void *target;   /* surface behind an offscreen renderer */
 } sdl_object;
 
+typedef struct particle_pool particle_pool;
+void particles_free(particle_pool *pool);
+typedef struct rewind_buffer rewind_buffer;
+void rewind_free(rewind_buffer *rewind);
+typedef struct capture capture;
+void capture_free(capture *cap);
+
 
 /* color/settings */
 functor_t rgba_f;
@@ -52,6 +67,13 @@ functor_t pt_f;
 functor_t line_f;
 functor_t rect_f;
 functor_t fill_f;
+/* particle functors */
+functor_t burst_f;
+functor_t cone_f;
+/* render target/capture functors */
+functor_t offscreen_f;
+functor_t ppm_f;
+functor_t raw_f;
 /* event functors */
 functor_t window_f;
 functor_t key_f;
@@ -64,6 +86,11 @@ void initialize_terms() {
     line_f = PL_new_functor(PL_new_atom("line"), 2);
     rect_f = PL_new_functor(PL_new_atom("rect"), 2);
     fill_f = PL_new_functor(PL_new_atom("fill"), 1);
+    burst_f = PL_new_functor(PL_new_atom("burst"), 3);
+    cone_f = PL_new_functor(PL_new_atom("cone"), 5);
+    offscreen_f = PL_new_functor(PL_new_atom("offscreen"), 2);
+    ppm_f = PL_new_functor(PL_new_atom("ppm"), 1);
+    raw_f = PL_new_functor(PL_new_atom("raw"), 1);
     key_f = PL_new_functor(PL_new_atom("key"), 3);
     window_f = PL_new_functor(PL_new_atom("window"), 1);
     mouse_position_f = PL_new_functor(PL_new_atom("mouse_position"), 2);
@@ -83,6 +110,7 @@ sdl_object *object_create(term_t term, object_kind kind, void *value) {
     object->kind = kind;
     object->refs = 1;
     object->object = value;
+    object->target = NULL;
     PL_unify_blob(term, object, size, &sdl_blob);
     return object;
 }
@@ -114,6 +142,18 @@ int sdl_blob_release(term_t term) {
                 break;
             case KIND_RENDERER:
                 SDL_DestroyRenderer((SDL_Renderer *)object->object);
+                if (object->target) {
+                    SDL_FreeSurface((SDL_Surface *)object->target);
+                }
+                break;
+            case KIND_PARTICLES:
+                particles_free((particle_pool *)object->object);
+                break;
+            case KIND_REWIND:
+                rewind_free((rewind_buffer *)object->object);
+                break;
+            case KIND_CAPTURE:
+                capture_free((capture *)object->object);
                 break;
             default:
                 break;
@@ -218,7 +258,41 @@ static foreign_t pl_sdl_destroy_window(term_t window) {
     return TRUE;
 }
 
+/* Renders into a software surface with no window, for headless capture */
+static foreign_t create_offscreen_renderer(term_t target, term_t handle) {
+    int w;
+    int h;
+    term_t wterm = PL_new_term_ref();
+    term_t hterm = PL_new_term_ref();
+    if (!(PL_get_arg(1, target, wterm) && PL_get_integer(wterm, &w) &&
+          PL_get_arg(2, target, hterm) && PL_get_integer(hterm, &h))) {
+        return FALSE;
+    }
+    debug_log("SDL_CreateRGBSurfaceWithFormat(%d, %d)\n", w, h);
+    SDL_Surface *surface = SDL_CreateRGBSurfaceWithFormat(0, w, h, 32, SDL_PIXELFORMAT_ARGB8888);
+    if (!surface) {
+        debug_log("Could not create surface: %s\n", SDL_GetError());
+        return FALSE;
+    }
+    SDL_Renderer *renderer = SDL_CreateSoftwareRenderer(surface);
+    if (!renderer) {
+        SDL_FreeSurface(surface);
+        return FALSE;
+    }
+    sdl_object *obj = object_create(handle, KIND_RENDERER, renderer);
+    if (NULL == obj) {
+        SDL_DestroyRenderer(renderer);
+        SDL_FreeSurface(surface);
+        return FALSE;
+    }
+    obj->target = surface;
+    return TRUE;
+}
+
 static foreign_t pl_sdl_create_renderer(term_t window, term_t flags, term_t handle) {
+    if (PL_is_functor(window, offscreen_f)) {
+        return create_offscreen_renderer(window, handle);
+    }
     sdl_object *winobj = object_read(window, KIND_WINDOW);
     if (winobj == NULL) {
         debug_log("NOT A WINDOW\n");
@@ -448,7 +522,7 @@ int get_rect(term_t term, SDL_Rect *r) {
     if (!PL_get_arg(2, rect, bterm)) goto fail;
     if (!get_point(bterm, &b)) goto fail;
     r->x = min(a.x, b.x);
-    r->y = min(a.y, a.y);
+    r->y = min(a.y, b.y);
     r->w = abs(b.x - a.x);
     r->h = abs(b.y - a.y);
     PL_close_foreign_frame(fid);
@@ -473,6 +547,25 @@ fail:
     return FALSE;
 }
 
+/* Trivial rejection against the renderer viewport, so off-screen primitives
+ * never reach the (software) rasterizer. */
+int point_visible(const SDL_Rect *view, const SDL_Point *p) {
+    return p->x >= 0 && p->x < view->w && p->y >= 0 && p->y < view->h;
+}
+
+int line_visible(const SDL_Rect *view, const SDL_Point *a, const SDL_Point *b) {
+    if (a->x < 0 && b->x < 0) return FALSE;
+    if (a->y < 0 && b->y < 0) return FALSE;
+    if (a->x >= view->w && b->x >= view->w) return FALSE;
+    if (a->y >= view->h && b->y >= view->h) return FALSE;
+    return TRUE;
+}
+
+int rect_visible(const SDL_Rect *view, const SDL_Rect *r) {
+    SDL_Rect bounds = { 0, 0, view->w, view->h };
+    return SDL_HasIntersection(&bounds, r);
+}
+
 static foreign_t pl_sdl_draw(term_t renderer, term_t shape) {
     sdl_object *robj = object_read(renderer, KIND_RENDERER);
     if (robj == NULL) {
@@ -482,20 +575,22 @@ static foreign_t pl_sdl_draw(term_t renderer, term_t shape) {
     SDL_Point a;
     SDL_Point b;
     SDL_Rect r;
+    SDL_Rect view;
+    SDL_RenderGetViewport(robj->object, &view);
     if (get_point(shape, &a)) {
-        if (SDL_RenderDrawPoint(robj->object, a.x, a.y)) {
+        if (point_visible(&view, &a) && SDL_RenderDrawPoint(robj->object, a.x, a.y)) {
             debug_log("Could not draw point: %s\n", SDL_GetError());
         }
     } else if (get_line(shape, &a, &b)) {
-        if (SDL_RenderDrawLine(robj->object, a.x, a.y, b.x, b.y)) {
+        if (line_visible(&view, &a, &b) && SDL_RenderDrawLine(robj->object, a.x, a.y, b.x, b.y)) {
             debug_log("Could not draw line: %s\n", SDL_GetError());
         }
     } else if (get_rect(shape, &r)) {
-        if (SDL_RenderDrawRect(robj->object, &r)) {
+        if (rect_visible(&view, &r) && SDL_RenderDrawRect(robj->object, &r)) {
             debug_log("Draw rect failed: %s\n", SDL_GetError());
         }
     } else if (get_fill_rect(shape, &r)) {
-        if (SDL_RenderFillRect(robj->object, &r)) {
+        if (rect_visible(&view, &r) && SDL_RenderFillRect(robj->object, &r)) {
             debug_log("Draw fill rect failed: %s\n", SDL_GetError());
         }
     } else {
@@ -514,10 +609,12 @@ static foreign_t pl_sdl_draw_many(term_t renderer, term_t shapes) {
     SDL_Point a;
     SDL_Point b;
     SDL_Rect r;
+    SDL_Rect view;
     Uint8 rgba[4];
     if (PL_skip_list(shapes, 0, NULL) != PL_LIST) {
         return FALSE;
     }
+    SDL_RenderGetViewport(robj->object, &view);
     term_t shape = PL_new_term_ref();
     term_t tail = PL_copy_term_ref(shapes);
     fid_t fid = PL_open_foreign_frame();
@@ -528,22 +625,22 @@ static foreign_t pl_sdl_draw_many(term_t renderer, term_t shapes) {
                 goto fail;
             }
         } else if (get_point(shape, &a)) {
-            if (SDL_RenderDrawPoint(robj->object, a.x, a.y)) {
+            if (point_visible(&view, &a) && SDL_RenderDrawPoint(robj->object, a.x, a.y)) {
                 debug_log("Could not draw point: %s\n", SDL_GetError());
                 goto fail;
             }
         } else if (get_line(shape, &a, &b)) {
-            if (SDL_RenderDrawLine(robj->object, a.x, a.y, b.x, b.y)) {
+            if (line_visible(&view, &a, &b) && SDL_RenderDrawLine(robj->object, a.x, a.y, b.x, b.y)) {
                 debug_log("Could not draw line: %s\n", SDL_GetError());
                 goto fail;
             }
         } else if (get_rect(shape, &r)) {
-            if (SDL_RenderDrawRect(robj->object, &r)) {
+            if (rect_visible(&view, &r) && SDL_RenderDrawRect(robj->object, &r)) {
                 debug_log("Draw rect failed: %s\n", SDL_GetError());
                 goto fail;
             }
         } else if (get_fill_rect(shape, &r)) {
-            if (SDL_RenderFillRect(robj->object, &r)) {
+            if (rect_visible(&view, &r) && SDL_RenderFillRect(robj->object, &r)) {
                 debug_log("Draw fill rect failed: %s\n", SDL_GetError());
                 goto fail;
             }
@@ -559,6 +656,1233 @@ fail:
     return FALSE;
 }
 
+/* Particle system
+ *
+ * A fixed-capacity pool stored as parallel arrays. Dead slots are recycled
+ * through a free list, so spawning and expiring never allocate. Every
+ * particle in a pool shares one color; its alpha fades out over its lifetime
+ * and is quantized to PARTICLE_FADE_LEVELS so a whole pool can be submitted
+ * with one SDL_RenderDrawPoints call per level.
+ */
+#define PARTICLE_FADE_LEVELS 8
+
+struct particle_pool {
+    int capacity;
+    int live;
+    int high;       /* slots [0, high) have been handed out at least once */
+    int free_top;
+    int *free_list;
+    float *x;
+    float *y;
+    float *vx;
+    float *vy;
+    float *age;
+    float *ttl;     /* 0 marks a dead slot */
+    Uint8 rgba[4];
+    Uint32 seed;
+    SDL_Point *points;
+};
+
+particle_pool *particles_alloc(int capacity, Uint8 rgba[4]) {
+    particle_pool *pool = calloc(1, sizeof(particle_pool));
+    if (pool == NULL) {
+        return NULL;
+    }
+    pool->capacity = capacity;
+    pool->free_list = malloc(capacity * sizeof(int));
+    pool->x = malloc(capacity * sizeof(float));
+    pool->y = malloc(capacity * sizeof(float));
+    pool->vx = malloc(capacity * sizeof(float));
+    pool->vy = malloc(capacity * sizeof(float));
+    pool->age = malloc(capacity * sizeof(float));
+    pool->ttl = malloc(capacity * sizeof(float));
+    pool->points = malloc(capacity * sizeof(SDL_Point));
+    if (!(pool->free_list && pool->x && pool->y && pool->vx && pool->vy && pool->age && pool->ttl && pool->points)) {
+        particles_free(pool);
+        return NULL;
+    }
+    memcpy(pool->rgba, rgba, sizeof(pool->rgba));
+    pool->seed = (Uint32)(uintptr_t)pool | 1;
+    return pool;
+}
+
+void particles_free(particle_pool *pool) {
+    free(pool->free_list);
+    free(pool->x);
+    free(pool->y);
+    free(pool->vx);
+    free(pool->vy);
+    free(pool->age);
+    free(pool->ttl);
+    free(pool->points);
+    free(pool);
+}
+
+/* xorshift32, returns a float in [0, 1) */
+float particles_random(particle_pool *pool) {
+    Uint32 x = pool->seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    pool->seed = x;
+    return (x >> 8) * (1.0f / 16777216.0f);
+}
+
+int particles_take(particle_pool *pool) {
+    if (pool->free_top > 0) {
+        return pool->free_list[--pool->free_top];
+    }
+    if (pool->high < pool->capacity) {
+        return pool->high++;
+    }
+    return -1;
+}
+
+void particles_spawn(particle_pool *pool, int count, double x, double y, double vx, double vy,
+                     double dir, double spread, double speed, double ttl) {
+    for (int n = 0; n < count; ++n) {
+        int i = particles_take(pool);
+        if (i < 0) {
+            return;
+        }
+        float theta = dir + (particles_random(pool) - 0.5f) * spread;
+        float v = speed * particles_random(pool);
+        pool->x[i] = x;
+        pool->y[i] = y;
+        pool->vx[i] = vx + v * cosf(theta);
+        pool->vy[i] = vy + v * sinf(theta);
+        pool->age[i] = 0;
+        pool->ttl[i] = ttl * (0.5f + 0.5f * particles_random(pool));
+        pool->live += 1;
+    }
+}
+
+void particles_update(particle_pool *pool, float delta) {
+    for (int i = 0; i < pool->high; ++i) {
+        if (pool->ttl[i] == 0) {
+            continue;
+        }
+        pool->age[i] += delta;
+        if (pool->age[i] >= pool->ttl[i]) {
+            pool->ttl[i] = 0;
+            pool->free_list[pool->free_top++] = i;
+            pool->live -= 1;
+            continue;
+        }
+        pool->x[i] += pool->vx[i] * delta;
+        pool->y[i] += pool->vy[i] * delta;
+    }
+}
+
+int particles_draw(particle_pool *pool, SDL_Renderer *renderer) {
+    SDL_Rect view;
+    int counts[PARTICLE_FADE_LEVELS] = { 0 };
+    int starts[PARTICLE_FADE_LEVELS];
+    SDL_RenderGetViewport(renderer, &view);
+    /* Counting sort of visible particles by fade level into pool->points */
+    for (int pass = 0; pass < 2; ++pass) {
+        for (int i = 0; i < pool->high; ++i) {
+            if (pool->ttl[i] == 0) {
+                continue;
+            }
+            SDL_Point p = { (int)pool->x[i], (int)pool->y[i] };
+            if (!point_visible(&view, &p)) {
+                continue;
+            }
+            /* Rounding can carry an age just under ttl past the last level */
+            int level = (int)(PARTICLE_FADE_LEVELS * pool->age[i] / pool->ttl[i]);
+            level = max(0, min(level, PARTICLE_FADE_LEVELS - 1));
+            if (pass == 0) {
+                counts[level] += 1;
+            } else {
+                pool->points[starts[level]++] = p;
+            }
+        }
+        if (pass == 0) {
+            int offset = 0;
+            for (int level = 0; level < PARTICLE_FADE_LEVELS; ++level) {
+                starts[level] = offset;
+                offset += counts[level];
+            }
+        }
+    }
+    for (int level = 0, offset = 0; level < PARTICLE_FADE_LEVELS; offset += counts[level], ++level) {
+        if (counts[level] == 0) {
+            continue;
+        }
+        Uint8 alpha = pool->rgba[3] * (PARTICLE_FADE_LEVELS - level) / PARTICLE_FADE_LEVELS;
+        if (SDL_SetRenderDrawColor(renderer, pool->rgba[0], pool->rgba[1], pool->rgba[2], alpha)) {
+            debug_log("Failed to set draw color: %s\n", SDL_GetError());
+            return FALSE;
+        }
+        if (SDL_RenderDrawPoints(renderer, pool->points + offset, counts[level])) {
+            debug_log("Could not draw points: %s\n", SDL_GetError());
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+int get_vec2(term_t term, double *x, double *y) {
+    term_t xterm = PL_new_term_ref();
+    term_t yterm = PL_new_term_ref();
+    if (!PL_is_functor(term, pt_f)) return FALSE;
+    if (!PL_get_arg(1, term, xterm) || !PL_get_float(xterm, x)) return FALSE;
+    if (!PL_get_arg(2, term, yterm) || !PL_get_float(yterm, y)) return FALSE;
+    return TRUE;
+}
+
+static foreign_t pl_sdl_create_particles(term_t capacity, term_t color, term_t handle) {
+    int cap;
+    Uint8 rgba[4];
+    if (!PL_get_integer(capacity, &cap) || cap <= 0) {
+        return FALSE;
+    }
+    if (!PL_is_functor(color, rgba_f)) {
+        return FALSE;
+    }
+    for (int i = 0; i < 4; ++i) {
+        term_t component = PL_new_term_ref();
+        long tmp;
+        if (!PL_get_arg(1 + i, color, component) || !PL_get_long(component, &tmp)) {
+            return FALSE;
+        }
+        rgba[i] = (Uint8)tmp;
+    }
+    particle_pool *pool = particles_alloc(cap, rgba);
+    if (pool == NULL) {
+        return FALSE;
+    }
+    if (NULL == object_create(handle, KIND_PARTICLES, pool)) {
+        particles_free(pool);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/* sdl_particles_spawn(+Particles, +Pos, +Vel, +Spec)
+ *
+ * Spec is burst(Count, Speed, Lifetime), which scatters particles in every
+ * direction, or cone(Count, Dir, Spread, Speed, Lifetime), which scatters
+ * them within Spread radians around Dir. Vel is added to every particle.
+ * Lifetime must be positive.
+ */
+static foreign_t pl_sdl_particles_spawn(term_t particles, term_t pos, term_t vel, term_t spec) {
+    sdl_object *obj = object_read(particles, KIND_PARTICLES);
+    if (obj == NULL) {
+        return FALSE;
+    }
+    double x, y, vx, vy;
+    if (!get_vec2(pos, &x, &y) || !get_vec2(vel, &vx, &vy)) {
+        return FALSE;
+    }
+    term_t args = PL_new_term_refs(5);
+    int count;
+    double dir = 0, spread = 2 * M_PI, speed, ttl;
+    if (PL_is_functor(spec, burst_f)) {
+        if (!(PL_get_arg(1, spec, args + 0) && PL_get_integer(args + 0, &count) &&
+              PL_get_arg(2, spec, args + 1) && PL_get_float(args + 1, &speed) &&
+              PL_get_arg(3, spec, args + 2) && PL_get_float(args + 2, &ttl))) {
+            return FALSE;
+        }
+    } else if (PL_is_functor(spec, cone_f)) {
+        if (!(PL_get_arg(1, spec, args + 0) && PL_get_integer(args + 0, &count) &&
+              PL_get_arg(2, spec, args + 1) && PL_get_float(args + 1, &dir) &&
+              PL_get_arg(3, spec, args + 2) && PL_get_float(args + 2, &spread) &&
+              PL_get_arg(4, spec, args + 3) && PL_get_float(args + 3, &speed) &&
+              PL_get_arg(5, spec, args + 4) && PL_get_float(args + 4, &ttl))) {
+            return FALSE;
+        }
+    } else {
+        debug_log("Unknown particle spawn spec\n");
+        return FALSE;
+    }
+    /* A zero lifetime would mark the slot dead without freeing it */
+    if (!((float)ttl > 0)) {
+        return FALSE;
+    }
+    particles_spawn(obj->object, count, x, y, vx, vy, dir, spread, speed, ttl);
+    return TRUE;
+}
+
+static foreign_t pl_sdl_particles_update(term_t particles, term_t delta) {
+    sdl_object *obj = object_read(particles, KIND_PARTICLES);
+    double d;
+    if (obj == NULL || !PL_get_float(delta, &d)) {
+        return FALSE;
+    }
+    /* Ages only move forward, and stay usable as fade levels */
+    if (!(isfinite(d) && d >= 0)) {
+        return FALSE;
+    }
+    particles_update(obj->object, (float)d);
+    return TRUE;
+}
+
+static foreign_t pl_sdl_particles_count(term_t particles, term_t count) {
+    sdl_object *obj = object_read(particles, KIND_PARTICLES);
+    if (obj == NULL) {
+        return FALSE;
+    }
+    return PL_unify_integer(count, ((particle_pool *)obj->object)->live);
+}
+
+static foreign_t pl_sdl_draw_particles(term_t renderer, term_t particles) {
+    sdl_object *robj = object_read(renderer, KIND_RENDERER);
+    sdl_object *pobj = object_read(particles, KIND_PARTICLES);
+    if (robj == NULL || pobj == NULL) {
+        return FALSE;
+    }
+    return particles_draw(pobj->object, robj->object);
+}
+
+/* Audio mixer
+ *
+ * Sounds are preloaded as mono float PCM at the device rate and mixed into a
+ * fixed set of voices from the SDL audio callback. The game thread never
+ * touches voice state: sdl_play_sound pushes a trigger onto a single-producer
+ * single-consumer ring which the callback drains at the start of each buffer.
+ * Neither side takes a lock, so a slow frame can't stall audio and a busy
+ * audio thread can't stall a frame. Works under SDL_AUDIODRIVER=dummy or disk.
+ */
+#define MIXER_MAX_SOUNDS 64
+#define MIXER_MAX_VOICES 64
+#define MIXER_QUEUE_SIZE 64 /* must be a power of two */
+
+typedef struct {
+    float *samples;
+    Uint32 length;
+} mixer_sound;
+
+typedef struct {
+    int sound;      /* -1 when idle */
+    Uint32 position;
+    float volume;
+    Uint32 started;
+} mixer_voice;
+
+typedef struct {
+    int sound;
+    float volume;
+} mixer_trigger;
+
+struct {
+    SDL_AudioDeviceID device;
+    SDL_AudioSpec spec;
+    int voice_limit;
+    int polyphony;  /* max simultaneous voices playing the same sound */
+    mixer_sound sounds[MIXER_MAX_SOUNDS];
+    atomic_int sound_count;
+    /* audio thread only */
+    mixer_voice voices[MIXER_MAX_VOICES];
+    Uint32 clock;
+    /* trigger ring: head written by the game thread, tail by the audio thread */
+    mixer_trigger queue[MIXER_QUEUE_SIZE];
+    atomic_uint head;
+    atomic_uint tail;
+    /* statistics */
+    atomic_uint dropped;
+    atomic_int active;
+    atomic_ullong frames;
+} mixer;
+
+void mixer_start(mixer_trigger *trigger) {
+    mixer_voice *victim = NULL;
+    int same = 0;
+    for (int i = 0; i < mixer.voice_limit; ++i) {
+        if (mixer.voices[i].sound == trigger->sound) {
+            same += 1;
+        }
+    }
+    for (int i = 0; i < mixer.voice_limit; ++i) {
+        mixer_voice *voice = &mixer.voices[i];
+        if (same >= mixer.polyphony) {
+            /* steal the oldest voice already playing this sound */
+            if (voice->sound == trigger->sound && (victim == NULL || voice->started < victim->started)) {
+                victim = voice;
+            }
+        } else if (voice->sound == -1) {
+            victim = voice;
+            break;
+        } else if (victim == NULL || voice->started < victim->started) {
+            victim = voice;
+        }
+    }
+    if (victim == NULL) {
+        return;
+    }
+    victim->sound = trigger->sound;
+    victim->position = 0;
+    victim->volume = trigger->volume;
+    victim->started = mixer.clock++;
+}
+
+void mixer_callback(void *userdata, Uint8 *stream, int len) {
+    float *out = (float *)stream;
+    int frames = len / sizeof(float);
+    unsigned tail = atomic_load_explicit(&mixer.tail, memory_order_relaxed);
+    unsigned head = atomic_load_explicit(&mixer.head, memory_order_acquire);
+    while (tail != head) {
+        mixer_start(&mixer.queue[tail & (MIXER_QUEUE_SIZE - 1)]);
+        tail += 1;
+    }
+    atomic_store_explicit(&mixer.tail, tail, memory_order_release);
+
+    memset(out, 0, len);
+    int active = 0;
+    for (int i = 0; i < mixer.voice_limit; ++i) {
+        mixer_voice *voice = &mixer.voices[i];
+        if (voice->sound == -1) {
+            continue;
+        }
+        mixer_sound *sound = &mixer.sounds[voice->sound];
+        Uint32 n = min(sound->length - voice->position, (Uint32)frames);
+        const float *src = sound->samples + voice->position;
+        for (Uint32 j = 0; j < n; ++j) {
+            out[j] += src[j] * voice->volume;
+        }
+        voice->position += n;
+        if (voice->position >= sound->length) {
+            voice->sound = -1;
+        } else {
+            active += 1;
+        }
+    }
+    for (int j = 0; j < frames; ++j) {
+        out[j] = max(-1.0f, min(1.0f, out[j]));
+    }
+    atomic_store_explicit(&mixer.active, active, memory_order_relaxed);
+    atomic_fetch_add_explicit(&mixer.frames, frames, memory_order_relaxed);
+}
+
+/* Publishes a sound to the audio thread; samples must not change afterwards */
+int mixer_add_sound(float *samples, Uint32 length) {
+    int count = atomic_load_explicit(&mixer.sound_count, memory_order_relaxed);
+    if (count >= MIXER_MAX_SOUNDS) {
+        debug_log("Too many sounds\n");
+        free(samples);
+        return -1;
+    }
+    mixer.sounds[count].samples = samples;
+    mixer.sounds[count].length = length;
+    atomic_store_explicit(&mixer.sound_count, count + 1, memory_order_release);
+    return count;
+}
+
+int get_int_option(term_t option, const char *name, int *value) {
+    atom_t atom;
+    size_t arity;
+    term_t arg = PL_new_term_ref();
+    if (!PL_get_name_arity(option, &atom, &arity) || arity != 1) return FALSE;
+    if (0 != strcmp(name, PL_atom_chars(atom))) return FALSE;
+    if (!PL_get_arg(1, option, arg)) return FALSE;
+    return PL_get_integer(arg, value);
+}
+
+/* sdl_open_audio(+Options)
+ *
+ * Options are frequency(Hz), samples(Frames), voices(N) and polyphony(N).
+ */
+static foreign_t pl_sdl_open_audio(term_t options) {
+    if (mixer.device != 0) {
+        debug_log("Audio already open\n");
+        return FALSE;
+    }
+    if (PL_skip_list(options, 0, NULL) != PL_LIST) {
+        return FALSE;
+    }
+    int frequency = 44100;
+    int samples = 1024;
+    int voices = 16;
+    int polyphony = 4;
+    term_t head = PL_new_term_ref();
+    term_t tail = PL_copy_term_ref(options);
+    while (PL_get_list(tail, head, tail)) {
+        if (get_int_option(head, "frequency", &frequency)) { }
+        else if (get_int_option(head, "samples", &samples)) { }
+        else if (get_int_option(head, "voices", &voices)) { }
+        else if (get_int_option(head, "polyphony", &polyphony)) { }
+        else { return FALSE; }
+    }
+    if (voices < 1 || voices > MIXER_MAX_VOICES || polyphony < 1) {
+        return FALSE;
+    }
+    mixer.voice_limit = voices;
+    mixer.polyphony = polyphony;
+    for (int i = 0; i < MIXER_MAX_VOICES; ++i) {
+        mixer.voices[i].sound = -1;
+    }
+    SDL_AudioSpec want = { 0 };
+    want.freq = frequency;
+    want.format = AUDIO_F32SYS;
+    want.channels = 1;
+    want.samples = samples;
+    want.callback = mixer_callback;
+    debug_log("SDL_OpenAudioDevice(%d, %d)\n", frequency, samples);
+    mixer.device = SDL_OpenAudioDevice(NULL, 0, &want, &mixer.spec, 0);
+    if (mixer.device == 0) {
+        debug_log("Could not open audio: %s\n", SDL_GetError());
+        return FALSE;
+    }
+    SDL_PauseAudioDevice(mixer.device, 0);
+    return TRUE;
+}
+
+static foreign_t pl_sdl_close_audio() {
+    if (mixer.device == 0) {
+        return TRUE;
+    }
+    SDL_CloseAudioDevice(mixer.device);
+    int count = atomic_load(&mixer.sound_count);
+    for (int i = 0; i < count; ++i) {
+        free(mixer.sounds[i].samples);
+    }
+    mixer.device = 0;
+    atomic_store(&mixer.sound_count, 0);
+    atomic_store(&mixer.head, 0);
+    atomic_store(&mixer.tail, 0);
+    return TRUE;
+}
+
+/* sdl_load_sound(+Path, -Id): Path is an atom or string naming a WAV file */
+static foreign_t pl_sdl_load_sound(term_t path, term_t id) {
+    char *file;
+    if (mixer.device == 0 || !PL_get_chars(path, &file, CVT_ATOM|CVT_STRING)) {
+        return FALSE;
+    }
+    SDL_AudioSpec spec;
+    Uint8 *buffer;
+    Uint32 length;
+    if (NULL == SDL_LoadWAV(file, &spec, &buffer, &length)) {
+        debug_log("Could not load %s: %s\n", file, SDL_GetError());
+        return FALSE;
+    }
+    SDL_AudioCVT cvt;
+    if (SDL_BuildAudioCVT(&cvt, spec.format, spec.channels, spec.freq, AUDIO_F32SYS, 1, mixer.spec.freq) < 0) {
+        SDL_FreeWAV(buffer);
+        return FALSE;
+    }
+    cvt.len = length;
+    cvt.buf = malloc(length * cvt.len_mult);
+    if (cvt.buf == NULL) {
+        SDL_FreeWAV(buffer);
+        return FALSE;
+    }
+    memcpy(cvt.buf, buffer, length);
+    SDL_FreeWAV(buffer);
+    if (SDL_ConvertAudio(&cvt)) {
+        free(cvt.buf);
+        return FALSE;
+    }
+    int sound = mixer_add_sound((float *)cvt.buf, cvt.len_cvt / sizeof(float));
+    return sound >= 0 && PL_unify_integer(id, sound);
+}
+
+/* sdl_synth_sound(+Spec, -Id)
+ *
+ * Spec is tone(Hz, Seconds, Decay) or noise(Seconds, Decay); the amplitude
+ * falls off as exp(-Decay * t).
+ */
+static foreign_t pl_sdl_synth_sound(term_t spec, term_t id) {
+    if (mixer.device == 0) {
+        return FALSE;
+    }
+    atom_t name;
+    size_t arity;
+    double args[3];
+    if (!PL_get_name_arity(spec, &name, &arity) || arity > 3) {
+        return FALSE;
+    }
+    for (size_t i = 0; i < arity; ++i) {
+        term_t arg = PL_new_term_ref();
+        if (!PL_get_arg(1 + i, spec, arg) || !PL_get_float(arg, &args[i])) {
+            return FALSE;
+        }
+    }
+    int tone = 0 == strcmp("tone", PL_atom_chars(name)) && arity == 3;
+    int noise = 0 == strcmp("noise", PL_atom_chars(name)) && arity == 2;
+    if (!tone && !noise) {
+        return FALSE;
+    }
+    double seconds = tone ? args[1] : args[0];
+    double decay = tone ? args[2] : args[1];
+    /* At least one sample, and few enough that the byte count fits */
+    double frames = seconds * mixer.spec.freq;
+    if (!(seconds > 0 && frames >= 1 && frames <= INT32_MAX / sizeof(float))) {
+        return FALSE;
+    }
+    Uint32 length = frames;
+    float *samples = malloc(length * sizeof(float));
+    if (samples == NULL) {
+        return FALSE;
+    }
+    Uint32 seed = 0x9e3779b9;
+    for (Uint32 i = 0; i < length; ++i) {
+        double t = (double)i / mixer.spec.freq;
+        double value;
+        if (tone) {
+            value = sin(2 * M_PI * args[0] * t);
+        } else {
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            value = seed / 2147483648.0 - 1.0;
+        }
+        samples[i] = 0.5 * value * exp(-decay * t);
+    }
+    int sound = mixer_add_sound(samples, length);
+    return sound >= 0 && PL_unify_integer(id, sound);
+}
+
+static foreign_t pl_sdl_play_sound(term_t id, term_t volume) {
+    int sound;
+    double vol;
+    if (!PL_get_integer(id, &sound) || !PL_get_float(volume, &vol)) {
+        return FALSE;
+    }
+    if (sound < 0 || sound >= atomic_load_explicit(&mixer.sound_count, memory_order_acquire)) {
+        return FALSE;
+    }
+    unsigned head = atomic_load_explicit(&mixer.head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(&mixer.tail, memory_order_acquire);
+    if (head - tail >= MIXER_QUEUE_SIZE) {
+        /* audio thread is behind; drop rather than wait for it */
+        atomic_fetch_add_explicit(&mixer.dropped, 1, memory_order_relaxed);
+        return TRUE;
+    }
+    mixer.queue[head & (MIXER_QUEUE_SIZE - 1)].sound = sound;
+    mixer.queue[head & (MIXER_QUEUE_SIZE - 1)].volume = vol;
+    atomic_store_explicit(&mixer.head, head + 1, memory_order_release);
+    return TRUE;
+}
+
+/* sdl_audio_stats(-audio_stats(ActiveVoices, FramesMixed, DroppedTriggers)) */
+static foreign_t pl_sdl_audio_stats(term_t stats) {
+    return PL_unify_term(stats,
+        PL_FUNCTOR_CHARS, "audio_stats", 3,
+            PL_INT, atomic_load(&mixer.active),
+            PL_INT64, (int64_t)atomic_load(&mixer.frames),
+            PL_INT, (int)atomic_load(&mixer.dropped));
+}
+
+/* Rewind buffer
+ *
+ * A ring of serialized snapshots bounded by entry count and total bytes. The
+ * oldest entry is stored whole; every later entry is the XOR of itself and
+ * its predecessor, run-length encoded as (zero run, literal run, literals)
+ * varint triples. Since XOR is its own inverse, the newest snapshot is kept
+ * decoded and popping steps backwards one delta at a time. Evicting the
+ * oldest entry decodes its successor into a new whole entry.
+ */
+typedef struct {
+    size_t length;  /* length of the decoded snapshot */
+    size_t size;    /* bytes in data */
+    Uint8 *data;    /* whole snapshot for the oldest entry, else a delta */
+} rewind_entry;
+
+struct rewind_buffer {
+    int capacity;
+    size_t byte_limit;
+    size_t bytes;
+    int first;
+    int count;
+    rewind_entry *entries;
+    Uint8 *newest;  /* decoded copy of the newest entry */
+    size_t newest_length;
+    size_t newest_alloc;
+    Uint8 *scratch;
+    size_t scratch_alloc;
+};
+
+rewind_buffer *rewind_alloc(int capacity, size_t byte_limit) {
+    rewind_buffer *rewind = calloc(1, sizeof(rewind_buffer));
+    if (rewind == NULL) {
+        return NULL;
+    }
+    rewind->capacity = capacity;
+    rewind->byte_limit = byte_limit;
+    rewind->entries = calloc(capacity, sizeof(rewind_entry));
+    if (rewind->entries == NULL) {
+        free(rewind);
+        return NULL;
+    }
+    return rewind;
+}
+
+void rewind_free(rewind_buffer *rewind) {
+    for (int i = 0; i < rewind->count; ++i) {
+        free(rewind->entries[(rewind->first + i) % rewind->capacity].data);
+    }
+    free(rewind->entries);
+    free(rewind->newest);
+    free(rewind->scratch);
+    free(rewind);
+}
+
+int rewind_reserve(Uint8 **buffer, size_t *alloc, size_t size) {
+    if (*alloc >= size) {
+        return TRUE;
+    }
+    Uint8 *grown = realloc(*buffer, size);
+    if (grown == NULL) {
+        return FALSE;
+    }
+    *buffer = grown;
+    *alloc = size;
+    return TRUE;
+}
+
+Uint8 *varint_put(Uint8 *out, size_t value) {
+    while (value >= 0x80) {
+        *out++ = (Uint8)(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = (Uint8)value;
+    return out;
+}
+
+/* Returns NULL if the varint runs past end or is too long for a size_t */
+const Uint8 *varint_get(const Uint8 *in, const Uint8 *end, size_t *value) {
+    size_t result = 0;
+    for (int shift = 0; in < end && shift < (int)(8 * sizeof(size_t)); shift += 7) {
+        Uint8 byte = *in++;
+        result |= (size_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return in;
+        }
+    }
+    return NULL;
+}
+
+/* Encodes a XOR b (the shorter one zero padded) into out, returning its size.
+ * out must hold at least 2 * max(alen, blen) + 16 bytes. */
+size_t delta_encode(const Uint8 *a, size_t alen, const Uint8 *b, size_t blen, Uint8 *out) {
+    size_t len = max(alen, blen);
+    Uint8 *start = out;
+    size_t i = 0;
+    while (i < len) {
+        size_t zeros = i;
+        while (i < len && (i < alen ? a[i] : 0) == (i < blen ? b[i] : 0)) i++;
+        if (i == len) {
+            break;
+        }
+        size_t literal = i;
+        while (i < len && (i < alen ? a[i] : 0) != (i < blen ? b[i] : 0)) i++;
+        out = varint_put(out, literal - zeros);
+        out = varint_put(out, i - literal);
+        for (size_t j = literal; j < i; ++j) {
+            *out++ = (j < alen ? a[j] : 0) ^ (j < blen ? b[j] : 0);
+        }
+    }
+    return out - start;
+}
+
+/* Applies a delta in place to the first limit bytes of buffer, which must
+ * already be zero padded past the shorter snapshot. Fails on a delta that
+ * would write outside them. */
+int delta_apply(Uint8 *buffer, size_t limit, const Uint8 *delta, size_t size) {
+    const Uint8 *end = delta + size;
+    size_t offset = 0;
+    while (delta < end) {
+        size_t zeros, literal;
+        if (!(delta = varint_get(delta, end, &zeros)) || !(delta = varint_get(delta, end, &literal))) {
+            return FALSE;
+        }
+        if (zeros > limit - offset) {
+            return FALSE;
+        }
+        offset += zeros;
+        if (literal > limit - offset || literal > (size_t)(end - delta)) {
+            return FALSE;
+        }
+        for (size_t j = 0; j < literal; ++j) {
+            buffer[offset++] ^= *delta++;
+        }
+    }
+    return TRUE;
+}
+
+rewind_entry *rewind_entry_at(rewind_buffer *rewind, int index) {
+    return &rewind->entries[(rewind->first + index) % rewind->capacity];
+}
+
+/* Fails, leaving the buffer unchanged, if the successor can't be rebuilt */
+int rewind_evict(rewind_buffer *rewind) {
+    rewind_entry *oldest = rewind_entry_at(rewind, 0);
+    if (rewind->count > 1) {
+        rewind_entry *next = rewind_entry_at(rewind, 1);
+        size_t span = max(oldest->length, next->length);
+        Uint8 *whole = malloc(max(span, (size_t)1));
+        if (whole == NULL) {
+            return FALSE;
+        }
+        memcpy(whole, oldest->data, oldest->length);
+        memset(whole + oldest->length, 0, span - oldest->length);
+        delta_apply(whole, span, next->data, next->size);
+        rewind->bytes += next->length;
+        rewind->bytes -= next->size;
+        free(next->data);
+        next->data = whole;
+        next->size = next->length;
+    }
+    rewind->bytes -= oldest->size;
+    free(oldest->data);
+    oldest->data = NULL;
+    rewind->first = (rewind->first + 1) % rewind->capacity;
+    rewind->count -= 1;
+    return TRUE;
+}
+
+int rewind_push(rewind_buffer *rewind, const Uint8 *snapshot, size_t length) {
+    if (rewind->count == rewind->capacity && !rewind_evict(rewind)) {
+        return FALSE;
+    }
+    Uint8 *data;
+    size_t size;
+    if (rewind->count == 0) {
+        size = length;
+        data = malloc(max(size, (size_t)1));
+        if (data == NULL) return FALSE;
+        memcpy(data, snapshot, length);
+    } else {
+        size_t span = max(length, rewind->newest_length);
+        if (!rewind_reserve(&rewind->scratch, &rewind->scratch_alloc, 2 * span + 16)) return FALSE;
+        size = delta_encode(rewind->newest, rewind->newest_length, snapshot, length, rewind->scratch);
+        data = malloc(max(size, (size_t)1));
+        if (data == NULL) return FALSE;
+        memcpy(data, rewind->scratch, size);
+    }
+    if (!rewind_reserve(&rewind->newest, &rewind->newest_alloc, max(length, (size_t)1))) {
+        free(data);
+        return FALSE;
+    }
+    memcpy(rewind->newest, snapshot, length);
+    rewind->newest_length = length;
+    rewind_entry *entry = rewind_entry_at(rewind, rewind->count);
+    entry->length = length;
+    entry->size = size;
+    entry->data = data;
+    rewind->count += 1;
+    rewind->bytes += size;
+    /* Without memory to evict, stay over the limit until the next push */
+    while (rewind->bytes > rewind->byte_limit && rewind->count > 1) {
+        if (!rewind_evict(rewind)) {
+            break;
+        }
+    }
+    return TRUE;
+}
+
+/* Removes the newest entry, leaving its snapshot in scratch */
+int rewind_pop(rewind_buffer *rewind, size_t *length) {
+    if (rewind->count == 0) {
+        return FALSE;
+    }
+    rewind_entry *entry = rewind_entry_at(rewind, rewind->count - 1);
+    if (!rewind_reserve(&rewind->scratch, &rewind->scratch_alloc, max(entry->length, (size_t)1))) {
+        return FALSE;
+    }
+    memcpy(rewind->scratch, rewind->newest, entry->length);
+    *length = entry->length;
+    if (rewind->count > 1) {
+        rewind_entry *previous = rewind_entry_at(rewind, rewind->count - 2);
+        size_t span = max(entry->length, previous->length);
+        if (!rewind_reserve(&rewind->newest, &rewind->newest_alloc, span)) {
+            return FALSE;
+        }
+        memset(rewind->newest + entry->length, 0, span - entry->length);
+        delta_apply(rewind->newest, span, entry->data, entry->size);
+        rewind->newest_length = previous->length;
+    } else {
+        rewind->newest_length = 0;
+    }
+    rewind->bytes -= entry->size;
+    free(entry->data);
+    entry->data = NULL;
+    rewind->count -= 1;
+    return TRUE;
+}
+
+static foreign_t pl_sdl_create_rewind(term_t entries, term_t bytes, term_t handle) {
+    int capacity;
+    int64_t limit;
+    if (!PL_get_integer(entries, &capacity) || capacity <= 0 || !PL_get_int64(bytes, &limit) || limit <= 0) {
+        return FALSE;
+    }
+    rewind_buffer *rewind = rewind_alloc(capacity, (size_t)limit);
+    if (rewind == NULL) {
+        return FALSE;
+    }
+    if (NULL == object_create(handle, KIND_REWIND, rewind)) {
+        rewind_free(rewind);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/* sdl_rewind_push(+Rewind, +Bytes): Bytes is a string such as the one made by
+ * fast_term_serialized/2 */
+static foreign_t pl_sdl_rewind_push(term_t handle, term_t snapshot) {
+    sdl_object *obj = object_read(handle, KIND_REWIND);
+    char *data;
+    size_t length;
+    if (obj == NULL || !PL_get_nchars(snapshot, &length, &data, CVT_STRING|REP_ISO_LATIN_1)) {
+        return FALSE;
+    }
+    return rewind_push(obj->object, (Uint8 *)data, length);
+}
+
+static foreign_t pl_sdl_rewind_pop(term_t handle, term_t snapshot) {
+    sdl_object *obj = object_read(handle, KIND_REWIND);
+    size_t length;
+    if (obj == NULL || !rewind_pop(obj->object, &length)) {
+        return FALSE;
+    }
+    rewind_buffer *rewind = obj->object;
+    return PL_unify_chars(snapshot, PL_STRING|REP_ISO_LATIN_1, length, (char *)rewind->scratch);
+}
+
+/* sdl_delta_encode(+Base, +Target, -Delta)
+ *
+ * The same XOR run-length coding the rewind buffer uses, exposed for byte
+ * strings. Delta starts with the varint length of Target.
+ */
+static foreign_t pl_sdl_delta_encode(term_t base, term_t target, term_t delta) {
+    char *a;
+    char *b;
+    size_t alen, blen;
+    if (!PL_get_nchars(base, &alen, &a, CVT_STRING|REP_ISO_LATIN_1|BUF_STACK)) return FALSE;
+    if (!PL_get_nchars(target, &blen, &b, CVT_STRING|REP_ISO_LATIN_1|BUF_STACK)) return FALSE;
+    Uint8 *out = malloc(2 * max(alen, blen) + 32);
+    if (out == NULL) {
+        return FALSE;
+    }
+    Uint8 *body = varint_put(out, blen);
+    size_t size = (body - out) + delta_encode((Uint8 *)a, alen, (Uint8 *)b, blen, body);
+    int result = PL_unify_chars(delta, PL_STRING|REP_ISO_LATIN_1, size, (char *)out);
+    free(out);
+    return result;
+}
+
+static foreign_t pl_sdl_delta_decode(term_t base, term_t delta, term_t target) {
+    char *a;
+    char *d;
+    size_t alen, dlen, blen;
+    if (!PL_get_nchars(base, &alen, &a, CVT_STRING|REP_ISO_LATIN_1|BUF_STACK)) return FALSE;
+    if (!PL_get_nchars(delta, &dlen, &d, CVT_STRING|REP_ISO_LATIN_1|BUF_STACK)) return FALSE;
+    const Uint8 *body = varint_get((Uint8 *)d, (Uint8 *)d + dlen, &blen);
+    /* Every byte past the base comes from a literal, so a longer target is garbage */
+    if (body == NULL || blen > alen + dlen) {
+        return FALSE;
+    }
+    size_t span = max(alen, blen);
+    Uint8 *out = malloc(max(span, (size_t)1));
+    if (out == NULL) {
+        return FALSE;
+    }
+    memcpy(out, a, alen);
+    memset(out + alen, 0, span - alen);
+    int result = delta_apply(out, span, body, dlen - (body - (Uint8 *)d)) &&
+                 PL_unify_chars(target, PL_STRING|REP_ISO_LATIN_1, blen, (char *)out);
+    free(out);
+    return result;
+}
+
+/* sdl_rewind_stats(+Rewind, -rewind_stats(Entries, Bytes)) */
+static foreign_t pl_sdl_rewind_stats(term_t handle, term_t stats) {
+    sdl_object *obj = object_read(handle, KIND_REWIND);
+    if (obj == NULL) {
+        return FALSE;
+    }
+    rewind_buffer *rewind = obj->object;
+    return PL_unify_term(stats,
+        PL_FUNCTOR_CHARS, "rewind_stats", 2,
+            PL_INT, rewind->count,
+            PL_INT64, (int64_t)rewind->bytes);
+}
+
+/* Frame capture
+ *
+ * sdl_capture_frame reads the renderer's pixels into a buffer from a fixed
+ * pool and queues it for a writer thread, which writes PPM files or appends
+ * to a raw RGB24 stream. The game thread only holds the lock long enough to
+ * take or queue a buffer. When the writer has fallen behind and no buffer is
+ * free, the frame is dropped and counted rather than waited for.
+ */
+#define CAPTURE_PPM 0
+#define CAPTURE_RAW 1
+
+struct capture {
+    SDL_Thread *thread;
+    SDL_mutex *lock;
+    SDL_cond *ready;
+    int format;
+    char *path;     /* file name prefix for PPM, file name for raw */
+    FILE *raw;
+    int width;
+    int height;
+    int size;
+    Uint8 **buffers;
+    Uint64 *numbers;
+    int *free_list;
+    int free_count;
+    int *queue;     /* ring of filled buffers */
+    int head;
+    int count;
+    int stopping;
+    Uint64 frames;
+    Uint64 written;
+    Uint64 dropped;
+    Uint64 failed;
+};
+
+int capture_write(capture *cap, const Uint8 *pixels, Uint64 number) {
+    size_t row = cap->width * 3;
+    if (cap->format == CAPTURE_RAW) {
+        return fwrite(pixels, row, cap->height, cap->raw) == (size_t)cap->height;
+    }
+    size_t len = snprintf(NULL, 0, "%s%06llu.ppm", cap->path, (unsigned long long)number) + 1;
+    char *name = malloc(len);
+    if (name == NULL) {
+        return FALSE;
+    }
+    snprintf(name, len, "%s%06llu.ppm", cap->path, (unsigned long long)number);
+    FILE *file = fopen(name, "wb");
+    free(name);
+    if (file == NULL) {
+        return FALSE;
+    }
+    int ok = fprintf(file, "P6\n%d %d\n255\n", cap->width, cap->height) > 0 &&
+             fwrite(pixels, row, cap->height, file) == (size_t)cap->height;
+    return fclose(file) == 0 && ok;
+}
+
+int capture_writer(void *data) {
+    capture *cap = data;
+    SDL_LockMutex(cap->lock);
+    for (;;) {
+        while (cap->count == 0 && !cap->stopping) {
+            SDL_CondWait(cap->ready, cap->lock);
+        }
+        if (cap->count == 0) {
+            break;
+        }
+        int index = cap->queue[cap->head];
+        cap->head = (cap->head + 1) % cap->size;
+        cap->count -= 1;
+        SDL_UnlockMutex(cap->lock);
+        int ok = capture_write(cap, cap->buffers[index], cap->numbers[index]);
+        SDL_LockMutex(cap->lock);
+        if (ok) {
+            cap->written += 1;
+        } else {
+            cap->failed += 1;
+        }
+        cap->free_list[cap->free_count++] = index;
+    }
+    SDL_UnlockMutex(cap->lock);
+    return 0;
+}
+
+/* Writes out everything queued, then stops the writer */
+void capture_stop(capture *cap) {
+    if (cap->thread == NULL) {
+        return;
+    }
+    SDL_LockMutex(cap->lock);
+    cap->stopping = 1;
+    SDL_CondSignal(cap->ready);
+    SDL_UnlockMutex(cap->lock);
+    SDL_WaitThread(cap->thread, NULL);
+    cap->thread = NULL;
+    if (cap->raw) {
+        fclose(cap->raw);
+        cap->raw = NULL;
+    }
+}
+
+void capture_free(capture *cap) {
+    capture_stop(cap);
+    if (cap->buffers) {
+        for (int i = 0; i < cap->size; ++i) {
+            free(cap->buffers[i]);
+        }
+    }
+    free(cap->buffers);
+    free(cap->numbers);
+    free(cap->free_list);
+    free(cap->queue);
+    SDL_free(cap->path);
+    if (cap->raw) {
+        fclose(cap->raw);
+    }
+    if (cap->ready) SDL_DestroyCond(cap->ready);
+    if (cap->lock) SDL_DestroyMutex(cap->lock);
+    free(cap);
+}
+
+capture *capture_alloc(int format, const char *path, int width, int height, int size) {
+    capture *cap = calloc(1, sizeof(capture));
+    if (cap == NULL) {
+        return NULL;
+    }
+    cap->format = format;
+    cap->width = width;
+    cap->height = height;
+    cap->size = size;
+    cap->path = SDL_strdup(path);
+    cap->buffers = calloc(size, sizeof(Uint8 *));
+    cap->numbers = calloc(size, sizeof(Uint64));
+    cap->free_list = calloc(size, sizeof(int));
+    cap->queue = calloc(size, sizeof(int));
+    cap->lock = SDL_CreateMutex();
+    cap->ready = SDL_CreateCond();
+    if (!(cap->path && cap->buffers && cap->numbers && cap->free_list && cap->queue && cap->lock && cap->ready)) {
+        capture_free(cap);
+        return NULL;
+    }
+    for (int i = 0; i < size; ++i) {
+        cap->buffers[i] = malloc((size_t)width * height * 3);
+        if (cap->buffers[i] == NULL) {
+            capture_free(cap);
+            return NULL;
+        }
+        cap->free_list[cap->free_count++] = i;
+    }
+    if (format == CAPTURE_RAW) {
+        cap->raw = fopen(path, "wb");
+        if (cap->raw == NULL) {
+            debug_log("Could not open %s\n", path);
+            capture_free(cap);
+            return NULL;
+        }
+    }
+    cap->thread = SDL_CreateThread(capture_writer, "capture", cap);
+    if (cap->thread == NULL) {
+        capture_free(cap);
+        return NULL;
+    }
+    return cap;
+}
+
+/* sdl_start_capture(+Renderer, +Output, +Buffers, -Capture)
+ *
+ * Output is ppm(Prefix), writing Prefix000000.ppm and so on, or raw(File),
+ * writing consecutive RGB24 frames to one file. Buffers is the size of the
+ * buffer pool and so how many frames may wait for the writer.
+ */
+static foreign_t pl_sdl_start_capture(term_t renderer, term_t output, term_t buffers, term_t handle) {
+    sdl_object *robj = object_read(renderer, KIND_RENDERER);
+    if (robj == NULL) {
+        return FALSE;
+    }
+    int size;
+    if (!PL_get_integer(buffers, &size) || size <= 0) {
+        return FALSE;
+    }
+    int format;
+    if (PL_is_functor(output, ppm_f)) {
+        format = CAPTURE_PPM;
+    } else if (PL_is_functor(output, raw_f)) {
+        format = CAPTURE_RAW;
+    } else {
+        return FALSE;
+    }
+    term_t pathterm = PL_new_term_ref();
+    char *path;
+    if (!PL_get_arg(1, output, pathterm) || !PL_get_chars(pathterm, &path, CVT_ATOM|CVT_STRING)) {
+        return FALSE;
+    }
+    int w;
+    int h;
+    if (SDL_GetRendererOutputSize(robj->object, &w, &h)) {
+        debug_log("Could not get output size: %s\n", SDL_GetError());
+        return FALSE;
+    }
+    capture *cap = capture_alloc(format, path, w, h, size);
+    if (cap == NULL) {
+        return FALSE;
+    }
+    if (NULL == object_create(handle, KIND_CAPTURE, cap)) {
+        capture_free(cap);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/* Must be called before sdl_render_present, while the frame is still there.
+ * Frames that can't be captured, after sdl_stop_capture or once the output
+ * size no longer matches the buffers, are counted as dropped so the game
+ * carries on. */
+static foreign_t pl_sdl_capture_frame(term_t handle, term_t renderer) {
+    sdl_object *cobj = object_read(handle, KIND_CAPTURE);
+    sdl_object *robj = object_read(renderer, KIND_RENDERER);
+    if (cobj == NULL || robj == NULL) {
+        return FALSE;
+    }
+    capture *cap = cobj->object;
+    int w;
+    int h;
+    int usable = cap->thread != NULL && 0 == SDL_GetRendererOutputSize(robj->object, &w, &h) &&
+                 w == cap->width && h == cap->height;
+    Uint64 number = cap->frames++;
+    SDL_LockMutex(cap->lock);
+    if (!usable || cap->free_count == 0) {
+        cap->dropped += 1;
+        SDL_UnlockMutex(cap->lock);
+        return TRUE;
+    }
+    int index = cap->free_list[--cap->free_count];
+    SDL_UnlockMutex(cap->lock);
+    int ok = 0 == SDL_RenderReadPixels(robj->object, NULL, SDL_PIXELFORMAT_RGB24, cap->buffers[index], cap->width * 3);
+    SDL_LockMutex(cap->lock);
+    if (ok) {
+        cap->numbers[index] = number;
+        cap->queue[(cap->head + cap->count) % cap->size] = index;
+        cap->count += 1;
+        SDL_CondSignal(cap->ready);
+    } else {
+        cap->failed += 1;
+        cap->free_list[cap->free_count++] = index;
+    }
+    SDL_UnlockMutex(cap->lock);
+    if (!ok) {
+        debug_log("Could not read pixels: %s\n", SDL_GetError());
+    }
+    return TRUE;
+}
+
+/* sdl_capture_stats(+Capture, -capture_stats(Frames, Written, Dropped, Failed)) */
+static foreign_t pl_sdl_capture_stats(term_t handle, term_t stats) {
+    sdl_object *obj = object_read(handle, KIND_CAPTURE);
+    if (obj == NULL) {
+        return FALSE;
+    }
+    capture *cap = obj->object;
+    SDL_LockMutex(cap->lock);
+    int64_t frames = cap->frames;
+    int64_t written = cap->written;
+    int64_t dropped = cap->dropped;
+    int64_t failed = cap->failed;
+    SDL_UnlockMutex(cap->lock);
+    return PL_unify_term(stats,
+        PL_FUNCTOR_CHARS, "capture_stats", 4,
+            PL_INT64, frames,
+            PL_INT64, written,
+            PL_INT64, dropped,
+            PL_INT64, failed);
+}
+
+static foreign_t pl_sdl_stop_capture(term_t handle) {
+    sdl_object *obj = object_read(handle, KIND_CAPTURE);
+    if (obj == NULL) {
+        return FALSE;
+    }
+    capture_stop(obj->object);
+    return TRUE;
+}
+
 static foreign_t pl_sdl_poll_events(term_t term) {
     term_t head = PL_new_term_ref();
     SDL_Event event;
@@ -841,6 +2165,7 @@ error:
 }
 
 static foreign_t pl_sdl_terminate() {
+    pl_sdl_close_audio();
     SDL_VideoQuit(); /* TODO: connect to initialization somehow? */
     SDL_Quit();
     return TRUE;
@@ -868,6 +2193,27 @@ install_t install_sdl() {
     PL_register_foreign("sdl_render_present", 1, pl_sdl_render_present, 0);
     PL_register_foreign("sdl_draw", 2, pl_sdl_draw, 0);
     PL_register_foreign("sdl_draw_many", 2, pl_sdl_draw_many, 0);
+    PL_register_foreign("sdl_create_particles", 3, pl_sdl_create_particles, 0);
+    PL_register_foreign("sdl_particles_spawn", 4, pl_sdl_particles_spawn, 0);
+    PL_register_foreign("sdl_particles_update", 2, pl_sdl_particles_update, 0);
+    PL_register_foreign("sdl_particles_count", 2, pl_sdl_particles_count, 0);
+    PL_register_foreign("sdl_draw_particles", 2, pl_sdl_draw_particles, 0);
+    PL_register_foreign("sdl_open_audio", 1, pl_sdl_open_audio, 0);
+    PL_register_foreign("sdl_close_audio", 0, pl_sdl_close_audio, 0);
+    PL_register_foreign("sdl_load_sound", 2, pl_sdl_load_sound, 0);
+    PL_register_foreign("sdl_synth_sound", 2, pl_sdl_synth_sound, 0);
+    PL_register_foreign("sdl_play_sound", 2, pl_sdl_play_sound, 0);
+    PL_register_foreign("sdl_audio_stats", 1, pl_sdl_audio_stats, 0);
+    PL_register_foreign("sdl_create_rewind", 3, pl_sdl_create_rewind, 0);
+    PL_register_foreign("sdl_rewind_push", 2, pl_sdl_rewind_push, 0);
+    PL_register_foreign("sdl_rewind_pop", 2, pl_sdl_rewind_pop, 0);
+    PL_register_foreign("sdl_rewind_stats", 2, pl_sdl_rewind_stats, 0);
+    PL_register_foreign("sdl_delta_encode", 3, pl_sdl_delta_encode, 0);
+    PL_register_foreign("sdl_delta_decode", 3, pl_sdl_delta_decode, 0);
+    PL_register_foreign("sdl_start_capture", 4, pl_sdl_start_capture, 0);
+    PL_register_foreign("sdl_capture_frame", 2, pl_sdl_capture_frame, 0);
+    PL_register_foreign("sdl_capture_stats", 2, pl_sdl_capture_stats, 0);
+    PL_register_foreign("sdl_stop_capture", 1, pl_sdl_stop_capture, 0);
     PL_register_foreign("sdl_poll_events", 1, pl_sdl_poll_events, 0);
     PL_register_foreign("sdl_terminate", 0, pl_sdl_terminate, 0);
 }
@@ -0,0 +1,18 @@
+% Cold start to the first presented frame for trees older than
+% --profile_startup. It repeats what their main/1 did before entering the
+% event loop, then prints the same first_frame line as startup_mark/2 and
+% halts. `make bench-startup` compiles it into the older tree.
+
+probe_main :-
+    sdl_init([video]),
+    initial_state(State),
+    vec2(Width, Height) = State.dim,
+    sdl_create_window("SDL Test", Width, Height, [], Window),
+    sdl_create_renderer(Window, [software], Renderer),
+    sdl_render_blendmode(Renderer, alpha),
+    draw_state(Renderer, State),
+    statistics(epoch, Epoch),
+    get_time(Now),
+    Elapsed is (Now - Epoch) * 1000,
+    format(user_error, "startup: ~w~t~20| ~1f ms~n", [first_frame, Elapsed]),
+    halt.
@@ -0,0 +1,112 @@
+:- use_module(library(plunit)).
+:- use_foreign_library(sdl).
+
+% Mixer checks under SDL's dummy audio driver, which pulls samples on its
+% own thread at the real rate without any hardware. Run with
+% `make test-audio`.
+
+open_dummy_audio :-
+    setenv('SDL_AUDIODRIVER', dummy),
+    sdl_init([audio]),
+    sdl_open_audio([samples(512), voices(8), polyphony(2)]).
+
+% Polls Goal every 10ms until it succeeds, failing after Timeout seconds,
+% so the tests follow the mixer thread rather than guessing its timing.
+wait_until(Goal, Timeout) :-
+    get_time(Start),
+    Deadline is Start + Timeout,
+    wait_until_(Goal, Deadline).
+
+wait_until_(Goal, _) :-
+    call(Goal),
+    !.
+wait_until_(Goal, Deadline) :-
+    get_time(Now),
+    Now < Deadline,
+    sleep(0.01),
+    wait_until_(Goal, Deadline).
+
+active_voices(Count) :-
+    sdl_audio_stats(audio_stats(Active, _, _)),
+    Active =:= Count.
+
+frames_past(Frames0) :-
+    sdl_audio_stats(audio_stats(_, Frames, _)),
+    Frames > Frames0.
+
+% Waits out anything a previous test left playing.
+quiet :-
+    wait_until(active_voices(0), 2).
+
+put_codes(Out, String) :-
+    string_codes(String, Codes),
+    maplist(put_byte(Out), Codes).
+
+put_le(Out, Bytes, Value) :-
+    forall(between(1, Bytes, I),
+           (Byte is (Value >> (8 * (I - 1))) /\ 255, put_byte(Out, Byte))).
+
+% A tenth of a second of 8-bit mono PCM at 8kHz.
+write_wav(File) :-
+    Rate = 8000,
+    Length = 800,
+    DataSize is 36 + Length,
+    setup_call_cleanup(
+        open(File, write, Out, [type(binary)]),
+        (put_codes(Out, "RIFF"), put_le(Out, 4, DataSize), put_codes(Out, "WAVE"),
+         put_codes(Out, "fmt "), put_le(Out, 4, 16),
+         put_le(Out, 2, 1), put_le(Out, 2, 1), put_le(Out, 4, Rate), put_le(Out, 4, Rate),
+         put_le(Out, 2, 1), put_le(Out, 2, 8),
+         put_codes(Out, "data"), put_le(Out, 4, Length),
+         forall(between(1, Length, I),
+                (Sample is 128 + round(100 * sin(I / 4)), put_byte(Out, Sample)))),
+        close(Out)).
+
+:- begin_tests(mixer, [setup(open_dummy_audio), cleanup(sdl_close_audio)]).
+
+test(callback_runs) :-
+    sdl_audio_stats(audio_stats(_, Frames0, _)),
+    assertion(wait_until(frames_past(Frames0), 1)).
+
+test(plays_voice) :-
+    quiet,
+    sdl_synth_sound(tone(440, 0.3, 1), Id),
+    sdl_play_sound(Id, 0.5),
+    assertion(wait_until(active_voices(1), 0.5)).
+
+test(polyphony_limit) :-
+    quiet,
+    sdl_synth_sound(noise(1, 1), Id),
+    forall(between(1, 6, _), sdl_play_sound(Id, 0.1)),
+    assertion(wait_until(active_voices(2), 0.5)),
+    sdl_audio_stats(audio_stats(Active, _, _)),
+    assertion(Active =:= 2).
+
+test(full_queue_drops) :-
+    quiet,
+    sdl_synth_sound(tone(880, 0.05, 1), Id),
+    sdl_audio_stats(audio_stats(_, _, Dropped0)),
+    forall(between(1, 1000, _), sdl_play_sound(Id, 0.1)),
+    sdl_audio_stats(audio_stats(_, _, Dropped1)),
+    assertion(Dropped1 > Dropped0).
+
+test(load_wav) :-
+    tmp_file(sound, Base),
+    atom_concat(Base, '.wav', File),
+    write_wav(File),
+    atom_string(File, Path),
+    call_cleanup(
+        (sdl_load_sound(File, FromAtom), sdl_load_sound(Path, FromString)),
+        delete_file(File)),
+    assertion(FromAtom \== FromString),
+    quiet,
+    sdl_play_sound(FromAtom, 0.5),
+    assertion(wait_until(active_voices(1), 0.5)).
+
+test(synth_needs_length, [fail]) :-
+    sdl_synth_sound(tone(440, 0, 1), _).
+
+test(synth_negative_length, [fail]) :-
+    sdl_synth_sound(noise(-1, 1), _).
+
+:- end_tests(mixer).
@@ -0,0 +1,340 @@
+:- use_module(library(plunit)).
+:- consult(plasteroids).
+
+% Property checks for the geometry kernels, each against a brute-force
+% reference on random inputs from a fixed seed, and pixel checks for the
+% rectangles sdl.c draws. Run with `make test`.
+
+uniform(Low, High, X) :-
+    random(R),
+    X is Low + (High - Low) * R.
+
+%% in_polygon/2 against the winding number
+
+% Sum of the signed angles each edge subtends at Pt: zero outside a simple
+% polygon, one turn inside it.
+winding_number(Pt, [First|Rest], Winding) :-
+    winding_sum(Pt, First, [First|Rest], 0, Sum),
+    Winding is round(Sum / (2 * pi)).
+
+winding_sum(Pt, First, [Last], Sum0, Sum) :-
+    !,
+    winding_turn(Pt, Last, First, Sum0, Sum).
+
+winding_sum(Pt, First, [A,B|Rest], Sum0, Sum) :-
+    winding_turn(Pt, A, B, Sum0, Sum1),
+    winding_sum(Pt, First, [B|Rest], Sum1, Sum).
+
+winding_turn(vec2(X, Y), vec2(X1, Y1), vec2(X2, Y2), Sum0, Sum) :-
+    AX is X1 - X,
+    AY is Y1 - Y,
+    BX is X2 - X,
+    BY is Y2 - Y,
+    Sum is Sum0 + atan2(AX * BY - AY * BX, AX * BX + AY * BY).
+
+in_polygon_agrees(Pt, Points) :-
+    (in_polygon(Pt, Points) -> Inside = true ; Inside = false),
+    winding_number(Pt, Points, Winding),
+    (Winding =\= 0 -> Expected = true ; Expected = false),
+    Inside == Expected.
+
+% Star shaped about a random center, so usually concave but never
+% self-intersecting.
+random_polygon(Center, Points) :-
+    uniform(0, 640, CX),
+    uniform(0, 480, CY),
+    Center = vec2(CX, CY),
+    random_between(3, 15, N),
+    findall(A, (between(1, N, _), uniform(0, 2 * pi, A)), Angles0),
+    msort(Angles0, Angles),
+    findall(vec2(X, Y),
+            (member(A, Angles),
+             uniform(5, 60, R),
+             X is CX + R * cos(A),
+             Y is CY + R * sin(A)),
+            Points).
+
+random_point_near(vec2(CX, CY), vec2(X, Y)) :-
+    uniform(-70, 70, DX),
+    uniform(-70, 70, DY),
+    X is CX + DX,
+    Y is CY + DY.
+
+:- begin_tests(in_polygon, [setup(set_random(seed(1)))]).
+
+test(random_polygons) :-
+    forall(between(1, 300, _),
+           (random_polygon(Center, Points),
+            forall(between(1, 20, _),
+                   (random_point_near(Center, Pt),
+                    assertion(in_polygon_agrees(Pt, Points)))))).
+
+test(asteroids) :-
+    forall(between(1, 100, _),
+           (make_asteroid(30, 640, 480, Asteroid),
+            asteroid_polygon(Asteroid, Points),
+            get_dict(pos, Asteroid, Center),
+            assertion(in_polygon(Center, Points)),
+            forall(between(1, 20, _),
+                   (random_point_near(Center, Pt),
+                    assertion(in_polygon_agrees(Pt, Points)))))).
+
+test(vertex_level_ray) :-
+    % The ray from (0, 0) passes exactly through the vertex at (10, 0).
+    Diamond = [vec2(10, 0), vec2(0, 10), vec2(-10, 0), vec2(0, -10)],
+    assertion(in_polygon(vec2(0, 0), Diamond)),
+    assertion(\+ in_polygon(vec2(-20, 0), Diamond)).
+
+:- end_tests(in_polygon).
+
+%% wrap_bounds/4
+
+random_screen(rect(vec2(L, T), vec2(R, B))) :-
+    uniform(-100, 100, L),
+    uniform(-100, 100, T),
+    uniform(100, 700, W),
+    uniform(100, 500, H),
+    R is L + W,
+    B is T + H.
+
+% A W x H box just past one edge of Screen, by Fraction of its own size.
+off_screen(left, rect(vec2(L, T), vec2(_, B)), W, H, F, rect(vec2(X0, Y0), vec2(X1, Y1))) :-
+    X1 is L - F * W, X0 is X1 - W,
+    uniform(T, B - H, Y0), Y1 is Y0 + H.
+off_screen(right, rect(vec2(_, T), vec2(R, B)), W, H, F, rect(vec2(X0, Y0), vec2(X1, Y1))) :-
+    X0 is R + F * W, X1 is X0 + W,
+    uniform(T, B - H, Y0), Y1 is Y0 + H.
+off_screen(top, rect(vec2(L, T), vec2(R, _)), W, H, F, rect(vec2(X0, Y0), vec2(X1, Y1))) :-
+    Y1 is T - F * H, Y0 is Y1 - H,
+    uniform(L, R - W, X0), X1 is X0 + W.
+off_screen(bottom, rect(vec2(L, _), vec2(R, B)), W, H, F, rect(vec2(X0, Y0), vec2(X1, Y1))) :-
+    Y0 is B + F * H, Y1 is Y0 + H,
+    uniform(L, R - W, X0), X1 is X0 + W.
+
+% Leaving by one edge moves the box by the screen size plus its own size.
+wrap_shift(left, rect(vec2(L, _), vec2(R, _)), W, _, DX, 0) :- DX is R - L + W.
+wrap_shift(right, rect(vec2(L, _), vec2(R, _)), W, _, DX, 0) :- DX is L - R - W.
+wrap_shift(top, rect(vec2(_, T), vec2(_, B)), _, H, 0, DY) :- DY is B - T + H.
+wrap_shift(bottom, rect(vec2(_, T), vec2(_, B)), _, H, 0, DY) :- DY is T - B - H.
+
+box_center(rect(vec2(X0, Y0), vec2(X1, Y1)), vec2(X, Y)) :-
+    X is (X0 + X1) / 2,
+    Y is (Y0 + Y1) / 2.
+
+overlaps(rect(vec2(L, T), vec2(R, B)), rect(vec2(X0, Y0), vec2(X1, Y1)), DX, DY) :-
+    X1 + DX >= L,
+    X0 + DX =< R,
+    Y1 + DY >= T,
+    Y0 + DY =< B.
+
+% A box that has only just left the screen comes back overlapping the
+% opposite edge, moved by exactly the expected amount.
+wrap_property(Side) :-
+    random_screen(Screen),
+    uniform(1, 50, W),
+    uniform(1, 50, H),
+    uniform(0.1, 0.9, F),
+    off_screen(Side, Screen, W, H, F, Box),
+    box_center(Box, Pos),
+    wrap_bounds(Screen, Box, Pos, Wrapped),
+    Pos = vec2(X, Y),
+    Wrapped = vec2(WX, WY),
+    DX is WX - X,
+    DY is WY - Y,
+    overlaps(Screen, Box, DX, DY),
+    wrap_shift(Side, Screen, W, H, EX, EY),
+    abs(DX - EX) < 1.0e-6,
+    abs(DY - EY) < 1.0e-6.
+
+on_screen_property :-
+    random_screen(Screen),
+    Screen = rect(vec2(L, T), vec2(R, B)),
+    uniform(1, 50, W),
+    uniform(1, 50, H),
+    uniform(L, R, X),
+    uniform(T, B, Y),
+    X0 is X - W / 2, X1 is X + W / 2,
+    Y0 is Y - H / 2, Y1 is Y + H / 2,
+    wrap_bounds(Screen, rect(vec2(X0, Y0), vec2(X1, Y1)), vec2(X, Y), Wrapped),
+    Wrapped == vec2(X, Y).
+
+:- begin_tests(wrap_bounds, [setup(set_random(seed(2)))]).
+
+test(on_screen_unchanged) :-
+    forall(between(1, 2000, _), assertion(on_screen_property)).
+
+test(wraps_to_opposite_edge, [forall(member(Side, [left, right, top, bottom]))]) :-
+    forall(between(1, 2000, _), assertion(wrap_property(Side))).
+
+:- end_tests(wrap_bounds).
+
+%% fastsin/2 against sin/1
+
+% The table is indexed by the nearest whole degree, so the error is at most
+% the change in sin over half a degree.
+fastsin_bound(Bound) :-
+    Bound is pi / 360 + 1.0e-9.
+
+:- begin_tests(fastsin, [setup(set_random(seed(3)))]).
+
+test(error_bound) :-
+    fastsin_bound(Bound),
+    forall(between(1, 20000, _),
+           (uniform(-1000, 1000, T),
+            fastsin(T, S),
+            assertion(abs(S - sin(T)) =< Bound))).
+
+test(cos_error_bound) :-
+    fastsin_bound(Bound),
+    forall(between(1, 20000, _),
+           (uniform(-1000, 1000, T),
+            fastcos(T, C),
+            assertion(abs(C - cos(T)) =< Bound))).
+
+test(whole_degrees) :-
+    forall(between(-720, 720, D),
+           (T is D * pi / 180,
+            fastsin(T, S),
+            assertion(abs(S - sin(T)) < 1.0e-9))).
+
+:- end_tests(fastsin).
+
+%% line_eq/3 and line_cross/3 against the parametric form
+
+% Integer endpoints keep the slopes of parallel lines exactly equal.
+random_line(line(vec2(X1, Y1), vec2(X2, Y2))) :-
+    random_between(-500, 500, X1),
+    random_between(-500, 500, Y1),
+    random_between(-500, 500, X2),
+    random_between(-500, 500, Y2),
+    X1 =\= X2.
+
+close_to(A, B) :-
+    abs(A - B) =< 1.0e-6 * max(1, abs(B)).
+
+line_eq_property :-
+    random_line(Line),
+    Line = line(vec2(X1, Y1), vec2(X2, Y2)),
+    line_eq(Line, Slope, YIntercept),
+    close_to(Slope * X1 + YIntercept, Y1),
+    close_to(Slope * X2 + YIntercept, Y2).
+
+% P1 + T * (P2 - P1) = Q1 + S * (Q2 - Q1), solved for T by Cramer's rule.
+% Fails for parallel lines.
+parametric_cross(line(vec2(PX1, PY1), vec2(PX2, PY2)),
+                 line(vec2(QX1, QY1), vec2(QX2, QY2)), vec2(X, Y)) :-
+    DX1 is PX2 - PX1, DY1 is PY2 - PY1,
+    DX2 is QX2 - QX1, DY2 is QY2 - QY1,
+    Det is DX1 * DY2 - DY1 * DX2,
+    Det =\= 0,
+    T is ((QX1 - PX1) * DY2 - (QY1 - PY1) * DX2) / Det,
+    X is PX1 + T * DX1,
+    Y is PY1 + T * DY1.
+
+% Nearly parallel lines cross far away, where neither form is accurate, so
+% only pairs at least about six degrees apart are compared.
+line_cross_property :-
+    random_line(L1),
+    random_line(L2),
+    L1 = line(vec2(PX1, PY1), vec2(PX2, PY2)),
+    L2 = line(vec2(QX1, QY1), vec2(QX2, QY2)),
+    Sin is abs((PX2 - PX1) * (QY2 - QY1) - (PY2 - PY1) * (QX2 - QX1))
+         / (sqrt((PX2 - PX1)**2 + (PY2 - PY1)**2) * sqrt((QX2 - QX1)**2 + (QY2 - QY1)**2)),
+    (Sin < 0.1
+        -> true
+        ;  parametric_cross(L1, L2, vec2(EX, EY)),
+           line_cross(L1, L2, vec2(X, Y)),
+           close_to(X, EX),
+           close_to(Y, EY)).
+
+parallel_property :-
+    random_line(L1),
+    L1 = line(vec2(X1, Y1), vec2(X2, Y2)),
+    random_between(-100, 100, OX),
+    random_between(1, 100, OY),
+    QX1 is X1 + OX, QY1 is Y1 + OY,
+    QX2 is X2 + OX, QY2 is Y2 + OY,
+    L2 = line(vec2(QX1, QY1), vec2(QX2, QY2)),
+    \+ parametric_cross(L1, L2, _),
+    \+ line_cross(L1, L2, _).
+
+vertical_property :-
+    random_line(L1),
+    random_between(-500, 500, X),
+    random_between(-500, 500, Y1),
+    random_between(1, 500, H),
+    Y2 is Y1 + H,
+    Vertical = line(vec2(X, Y1), vec2(X, Y2)),
+    \+ line_eq(Vertical, _, _),
+    \+ line_cross(L1, Vertical, _),
+    \+ line_cross(Vertical, L1, _).
+
+:- begin_tests(lines, [setup(set_random(seed(4)))]).
+
+test(line_eq_through_endpoints) :-
+    forall(between(1, 2000, _), assertion(line_eq_property)).
+
+test(line_cross_matches_parametric) :-
+    forall(between(1, 2000, _), assertion(line_cross_property)).
+
+test(parallel_lines_fail) :-
+    forall(between(1, 500, _), assertion(parallel_property)).
+
+test(vertical_lines_fail) :-
+    forall(between(1, 500, _), assertion(vertical_property)).
+
+:- end_tests(lines).
+
+%% get_rect in sdl.c, checked on the pixels it draws
+
+% Draws Shape in red on a black 32x32 offscreen renderer and returns the
+% captured frame as RGB bytes.
+draw_pixels(Shape, Bytes) :-
+    sdl_create_renderer(offscreen(32, 32), [], Renderer),
+    sdl_render_color(Renderer, rgba(0, 0, 0, 255)),
+    sdl_render_clear(Renderer),
+    sdl_render_color(Renderer, rgba(255, 0, 0, 255)),
+    sdl_draw(Renderer, Shape),
+    tmp_file(frame, File),
+    call_cleanup(
+        (sdl_start_capture(Renderer, raw(File), 1, Capture),
+         sdl_capture_frame(Capture, Renderer),
+         sdl_stop_capture(Capture),
+         read_file_to_codes(File, Bytes, [type(binary)])),
+        delete_file(File)).
+
+lit(Bytes, X, Y) :-
+    I is (Y * 32 + X) * 3,
+    nth0(I, Bytes, 255).
+
+% Both orders of the corners of the rectangle from (4, 8) to (12, 20),
+% including the one with the lower corner first.
+rect_corners(vec2(4, 20), vec2(12, 8)).
+rect_corners(vec2(12, 8), vec2(4, 20)).
+rect_corners(vec2(4, 8), vec2(12, 20)).
+rect_corners(vec2(12, 20), vec2(4, 8)).
+
+:- begin_tests(get_rect).
+
+test(fill, [forall(rect_corners(A, B))]) :-
+    draw_pixels(fill(rect(A, B)), Bytes),
+    assertion(length(Bytes, 3072)),
+    assertion(lit(Bytes, 4, 8)),
+    assertion(lit(Bytes, 11, 19)),
+    assertion(lit(Bytes, 8, 14)),
+    assertion(\+ lit(Bytes, 3, 8)),
+    assertion(\+ lit(Bytes, 4, 7)),
+    assertion(\+ lit(Bytes, 12, 19)),
+    assertion(\+ lit(Bytes, 11, 20)).
+
+test(outline, [forall(rect_corners(A, B))]) :-
+    draw_pixels(rect(A, B), Bytes),
+    assertion(lit(Bytes, 4, 8)),
+    assertion(lit(Bytes, 11, 19)),
+    assertion(lit(Bytes, 4, 19)),
+    assertion(lit(Bytes, 11, 8)),
+    assertion(\+ lit(Bytes, 8, 14)),
+    assertion(\+ lit(Bytes, 4, 20)),
+    assertion(\+ lit(Bytes, 4, 7)).
+
+:- end_tests(get_rect).
@@ -56,13 +56,16 @@ fastsin(T, X) :-
 fastcos(T, X) :-
     fastsin(T + pi / 2, X).
 
-makesintab :-
-    findall(X, (
+% The sine table is expanded into static facts as this file is compiled, so
+% the saved state carries it ready-made rather than building it at startup.
+:- multifile term_expansion/2.
+
+term_expansion(sintab_facts, Facts) :-
+    findall(sintab(N, X), (
         between(0, 359, N),
         R is N * pi / 180,
-        X is sin(R),
-        assert(sintab(N, X))
-    ), _).
+        X is sin(R)
+    ), Facts).
 
-:- makesintab.
+sintab_facts.
 